@@ -0,0 +1,2989 @@
+﻿/*******************************************************************************
+The timeprint library parses, computes and formats time values. The timeprint
+command-line tool is a thin client of this library.
+*******************************************************************************/
+
+#include "timeprint.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <locale.h>
+#include <wchar.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+    #include <immintrin.h>
+    #include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace timeprint {
+
+using std::string;
+using std::time_t;
+using std::tm;
+using std::vector;
+using std::wstring;
+
+
+// Global Constants
+static const int secondsPerMinute       = 60;
+static const int secondsPerHour         = secondsPerMinute * 60;
+static const int secondsPerDay          = secondsPerHour * 24;
+static const int secondsPerNominalYear  = secondsPerDay * 365;
+static const int secondsPerTropicalYear = secondsPerNominalYear + (secondsPerDay / 400) * 497;   // 365+97/400 days
+
+static const int nanosecondsPerSecond   = 1000000000;
+
+
+//======================================================================================================================
+// Calendar Arithmetic
+//======================================================================================================================
+
+// Calendar arithmetic uses the proleptic Gregorian calendar, with days and seconds counted from the
+// Unix epoch (1970-01-01T00:00:00Z). Pure 64-bit integer math is used throughout, so these
+// functions are not limited to the time range of the C runtime library.
+
+static const int64_t daysPer400Years    = 146097;   // Days in a full Gregorian leap-year cycle
+static const int64_t secondsPer400Years = daysPer400Years * secondsPerDay;
+static const int64_t daysToEpoch        = 719468;   // Days from 0000-03-01 to 1970-01-01
+
+static constexpr int daysBeforeMonth[2][12] {
+    // Day of year of the first of each month, for common and leap years.
+    { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 },
+    { 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335 }
+};
+
+class CivilDate {
+  public:
+    int64_t year;
+    int     month;  // Month (1-12)
+    int     day;    // Day of month (1-31)
+};
+
+//__________________________________________________________________________________________________
+
+constexpr int64_t floorDiv (int64_t a, int64_t b) {
+    // Returns a/b rounded toward negative infinity, for positive b.
+    return (a >= 0) ? (a / b) : -((b - 1 - a) / b);
+}
+
+//__________________________________________________________________________________________________
+
+constexpr int64_t floorMod (int64_t a, int64_t b) {
+    // Returns the non-negative remainder of a/b, for positive b.
+    return a - b * floorDiv(a, b);
+}
+
+//__________________________________________________________________________________________________
+
+constexpr bool isLeapYear (int64_t year) {
+    return (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
+}
+
+//__________________________________________________________________________________________________
+
+constexpr int64_t daysFromCivil (int64_t year, int month, int day) {
+    // Returns the number of days since 1970-01-01 of the given date. Years are counted from March,
+    // which places the leap day at the end of the year.
+
+    year -= (month <= 2);
+
+    auto era         = floorDiv (year, 400);
+    auto yearOfEra   = year - era * 400;                                            // [0, 399]
+    auto dayOfYear   = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;  // [0, 365]
+    auto dayOfEra    = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+    return era * daysPer400Years + dayOfEra - daysToEpoch;
+}
+
+//__________________________________________________________________________________________________
+
+constexpr CivilDate civilFromDays (int64_t days) {
+    // Returns the date for the given number of days since 1970-01-01. This is the inverse of
+    // daysFromCivil().
+
+    days += daysToEpoch;
+
+    auto era       = floorDiv (days, daysPer400Years);
+    auto dayOfEra  = days - era * daysPer400Years;                                  // [0, 146096]
+    auto yearOfEra = (dayOfEra - dayOfEra/1460 + dayOfEra/36524 - dayOfEra/146096) / 365;
+    auto dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra/4 - yearOfEra/100);    // [0, 365]
+    auto monthPos  = (5 * dayOfYear + 2) / 153;                                     // March = 0
+    auto month     = static_cast<int>((monthPos < 10) ? (monthPos + 3) : (monthPos - 9));
+
+    return CivilDate {
+        yearOfEra + era * 400 + (month <= 2),
+        month,
+        static_cast<int>(dayOfYear - (153 * monthPos + 2) / 5 + 1)
+    };
+}
+
+static_assert (daysFromCivil(1970, 1, 1) == 0,                "Bad calendar epoch");
+static_assert (daysFromCivil(2000, 3, 1) == 11017,            "Bad leap-year handling");
+static_assert (daysFromCivil(1, 1, 1) == -719162,             "Bad proleptic calendar");
+static_assert (civilFromDays(11016).month == 2,               "Bad leap-day inversion");
+static_assert (civilFromDays(11016).day == 29,                "Bad leap-day inversion");
+static_assert (civilFromDays(-719162).year == 1,              "Bad proleptic calendar inversion");
+
+//__________________________________________________________________________________________________
+
+void tmFromEpoch (int64_t seconds, tm& result) {
+    // Sets all fields of the given time struct from the given number of seconds since the epoch,
+    // without any time zone adjustment. Unlike gmtime_s(), this handles any year representable in
+    // a tm struct.
+
+    auto days      = floorDiv (seconds, secondsPerDay);
+    auto dayTime   = static_cast<int>(seconds - days * secondsPerDay);
+    auto date      = civilFromDays (days);
+
+    result.tm_year  = static_cast<int>(date.year - 1900);
+    result.tm_mon   = date.month - 1;
+    result.tm_mday  = date.day;
+    result.tm_hour  = dayTime / secondsPerHour;
+    result.tm_min   = (dayTime / secondsPerMinute) % 60;
+    result.tm_sec   = dayTime % secondsPerMinute;
+    result.tm_wday  = static_cast<int>(floorMod (days + 4, 7));    // 1970-01-01 was a Thursday
+    result.tm_yday  = daysBeforeMonth[isLeapYear(date.year)][date.month - 1] + date.day - 1;
+    result.tm_isdst = 0;
+}
+
+//__________________________________________________________________________________________________
+
+int64_t epochFromTm (const tm& time) {
+    // Returns the number of seconds since the epoch for the given time struct, ignoring any time
+    // zone. Out-of-range fields are normalized, so for example the 32nd of January is the first of
+    // February, and hour -1 is the last hour of the previous day. The tm_wday, tm_yday and tm_isdst
+    // fields are ignored.
+
+    auto yearOffset = floorDiv (time.tm_mon, 12);
+    auto month      = static_cast<int>(time.tm_mon - 12 * yearOffset);
+    auto days       = daysFromCivil (1900 + time.tm_year + yearOffset, month + 1, 1) + time.tm_mday - 1;
+
+    return days * secondsPerDay
+         + int64_t(time.tm_hour) * secondsPerHour
+         + int64_t(time.tm_min)  * secondsPerMinute
+         + time.tm_sec;
+}
+
+
+//======================================================================================================================
+// Time Zones
+//======================================================================================================================
+
+class ZoneInfo {
+    // The state of a time zone at a given instant.
+
+  public:
+    int            offset       { 0 };          // Seconds east of UTC
+    bool           isDST        { false };      // True if daylight saving time is in effect
+    const wchar_t* abbreviation { L"UTC" };     // Time zone abbreviation, such as "PST"
+};
+
+//__________________________________________________________________________________________________
+
+int getSystemOffset (int64_t utcTime, bool& isDST) {
+    // Returns the system local time zone's offset from UTC, in seconds, at the given time. Also
+    // reports whether daylight saving time is in effect.
+    //
+    // The offset comes from the C runtime library, which only handles times from 1970 through 3000.
+    // Times outside that range are shifted by whole 400-year cycles, which repeat the same calendar
+    // (and so the same daylight saving rules). Offsets are cached per 15-minute block, since time
+    // zone transitions always fall on quarter hours.
+
+    static const int64_t lastRuntimeTime = 32535215999;     // 3000-12-31T23:59:59Z
+    static const int64_t cacheBlockSize  = 15 * secondsPerMinute;
+
+    class CacheEntry {
+      public:
+        int64_t block  { INT64_MIN };
+        int     offset { 0 };
+        bool    isDST  { false };
+    };
+
+    static thread_local CacheEntry cache[64];
+
+    auto  block = floorDiv (utcTime, cacheBlockSize);
+    auto& entry = cache[floorMod (block, std::size(cache))];
+
+    if (entry.block != block) {
+        time_t runtimeTime = utcTime;
+
+        if ((runtimeTime < 0) || (lastRuntimeTime < runtimeTime))
+            runtimeTime = floorMod (runtimeTime, secondsPer400Years);
+
+        tm localTime;
+        localtime_s (&localTime, &runtimeTime);
+
+        entry.block  = block;
+        entry.offset = static_cast<int>(epochFromTm(localTime) - runtimeTime);
+        entry.isDST  = localTime.tm_isdst > 0;
+    }
+
+    isDST = entry.isDST;
+    return entry.offset;
+}
+
+//__________________________________________________________________________________________________
+
+class ZoneRuleDate {
+    // The date and local time of a daylight saving time transition in a POSIX time zone rule.
+
+  public:
+    enum class Form {
+        MonthWeekDay,   // Mm.w.d: Day d (0 = Sunday) of week w (1-5, 5 = last) of month m
+        Julian,         // Jn: Day n (1-365), where February 29 is never counted
+        DayOfYear,      // n: Zero-based day n (0-365), where February 29 is counted in leap years
+    };
+
+    Form form    { Form::MonthWeekDay };
+    int  month   { 0 };
+    int  week    { 0 };
+    int  weekday { 0 };
+    int  day     { 0 };
+    int  time    { 2 * secondsPerHour };    // Local time of day of the transition, in seconds
+
+    int64_t localTime (int64_t year) const {
+        // Returns the local time of the transition in the given year, in seconds since the epoch.
+
+        auto yearStart = daysFromCivil (year, 1, 1);
+        int64_t days;
+
+        switch (form) {
+            case Form::Julian:
+                days = yearStart + day - 1 + ((day >= 60) && isLeapYear(year));
+                break;
+
+            case Form::DayOfYear:
+                days = yearStart + day;
+                break;
+
+            default: {
+                auto monthStart  = daysFromCivil (year, month, 1);
+                auto monthLength = daysFromCivil (year + (month / 12), (month % 12) + 1, 1) - monthStart;
+
+                days = monthStart + floorMod (weekday - (monthStart + 4), 7) + 7 * (week - 1);
+
+                // Week 5 means the last such weekday of the month.
+                while (days - monthStart >= monthLength)
+                    days -= 7;
+
+                break;
+            }
+        }
+
+        return days * secondsPerDay + time;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+class ZoneRule {
+    // A POSIX TZ time zone rule of the form `std offset [dst [offset] [,start[/time],end[/time]]]`,
+    // such as `PST8PDT,M3.2.0,M11.1.0`. As with the Microsoft C runtime library, the offset may be
+    // omitted (meaning zero), and a daylight saving zone given without transition dates follows the
+    // US rules.
+
+  public:
+    wstring      stdName;                   // Standard time abbreviation
+    wstring      dstName;                   // Daylight saving time abbreviation
+    int          stdOffset { 0 };           // Standard time seconds east of UTC
+    int          dstOffset { 0 };           // Daylight saving time seconds east of UTC
+    bool         hasOffset { false };       // True if the standard time offset was given
+    bool         hasDST    { false };       // True if the zone observes daylight saving time
+    bool         usRules   { false };       // True if transitions follow the US rules
+    ZoneRuleDate dstStart;                  // Start of daylight saving time, in local standard time
+    ZoneRuleDate dstEnd;                    // End of daylight saving time, in local daylight time
+
+    bool parse (const wchar_t* spec) {
+        // Parses the given rule string. Returns true on success, false if the string is not a valid
+        // rule.
+
+        auto it = spec;
+
+        if (!parseName (it, stdName))
+            return false;
+
+        hasOffset = (*it != 0) && !iswalpha(*it) && (*it != L'<');
+        if (hasOffset && !parseTime (it, stdOffset))
+            return false;
+
+        stdOffset = -stdOffset;     // POSIX offsets are given as seconds west of UTC.
+
+        if (*it == 0)
+            return true;
+
+        hasDST = true;
+
+        if (!parseName (it, dstName))
+            return false;
+
+        dstOffset = stdOffset + secondsPerHour;
+
+        if ((*it != 0) && (*it != L',')) {
+            if (!parseTime (it, dstOffset))
+                return false;
+            dstOffset = -dstOffset;
+        }
+
+        if (*it == 0) {
+            usRules = true;
+            return true;
+        }
+
+        return (*it++ == L',') && parseDate (it, dstStart)
+            && (*it++ == L',') && parseDate (it, dstEnd)
+            && (*it == 0);
+    }
+
+    ZoneInfo lookup (int64_t utcTime) const {
+        // Returns the state of the zone at the given time.
+
+        if (hasDST) {
+            // Find the year in local standard time, and get that year's daylight saving interval.
+            auto year  = civilFromDays (floorDiv (utcTime + stdOffset, secondsPerDay)).year;
+            auto start = startDate(year).localTime(year) - stdOffset;
+            auto end   = endDate(year).localTime(year) - dstOffset;
+
+            // In the southern hemisphere, daylight saving time spans the new year.
+            auto isDST = (start < end) ? ((start <= utcTime) && (utcTime < end))
+                                       : ((utcTime < end) || (start <= utcTime));
+            if (isDST)
+                return { dstOffset, true, dstName.c_str() };
+        }
+
+        return { stdOffset, false, stdName.c_str() };
+    }
+
+  private:
+    const ZoneRuleDate& startDate (int64_t year) const {
+        // US daylight saving time started on the last Sunday of April through 1986, the first
+        // Sunday of April through 2006, and the second Sunday of March since 2007.
+        static const ZoneRuleDate usStart[3] {
+            { ZoneRuleDate::Form::MonthWeekDay, 4, 5, 0 },
+            { ZoneRuleDate::Form::MonthWeekDay, 4, 1, 0 },
+            { ZoneRuleDate::Form::MonthWeekDay, 3, 2, 0 },
+        };
+
+        if (!usRules) return dstStart;
+        return usStart[(year >= 1987) + (year >= 2007)];
+    }
+
+    const ZoneRuleDate& endDate (int64_t year) const {
+        // US daylight saving time ended on the last Sunday of October through 2006, and on the
+        // first Sunday of November since 2007.
+        static const ZoneRuleDate usEnd[2] {
+            { ZoneRuleDate::Form::MonthWeekDay, 10, 5, 0 },
+            { ZoneRuleDate::Form::MonthWeekDay, 11, 1, 0 },
+        };
+
+        if (!usRules) return dstEnd;
+        return usEnd[year >= 2007];
+    }
+
+    static bool parseNumber (const wchar_t*& it, int maxDigits, int& value) {
+        // Parses an unsigned decimal number of one to maxDigits digits.
+        auto start = it;
+        for (value = 0;  iswdigit(*it) && (it - start < maxDigits);  ++it)
+            value = 10 * value + (*it - L'0');
+        return it != start;
+    }
+
+    static bool parseName (const wchar_t*& it, wstring& name) {
+        // Parses a zone abbreviation, either three or more letters, or any characters enclosed in
+        // angle brackets (for example, `<+0530>`).
+
+        auto start = it;
+
+        if (*it == L'<') {
+            while (*++it && (*it != L'>'))
+                continue;
+            if (*it != L'>')
+                return false;
+            name.assign (start + 1, it++);
+        } else {
+            while (iswalpha(*it))
+                ++it;
+            name.assign (start, it);
+        }
+
+        return name.length() >= 3;
+    }
+
+    static bool parseTime (const wchar_t*& it, int& seconds) {
+        // Parses a time or offset of the form `[+|-]hh[:mm[:ss]]`, in seconds.
+
+        auto sign = 1;
+        if ((*it == L'+') || (*it == L'-'))
+            sign = (*it++ == L'-') ? -1 : 1;
+
+        int hours, minutes = 0, secs = 0;
+
+        if (!parseNumber (it, 3, hours))
+            return false;
+        if ((*it == L':') && !parseNumber (++it, 2, minutes))
+            return false;
+        if ((*it == L':') && !parseNumber (++it, 2, secs))
+            return false;
+
+        seconds = sign * (hours * secondsPerHour + minutes * secondsPerMinute + secs);
+        return true;
+    }
+
+    static bool parseDate (const wchar_t*& it, ZoneRuleDate& date) {
+        // Parses a transition date of the form `Jn`, `n` or `Mm.w.d`, with optional `/time`.
+
+        using Form = ZoneRuleDate::Form;
+
+        if (*it == L'M') {
+            date.form = Form::MonthWeekDay;
+            if (!parseNumber (++it, 2, date.month) || (date.month < 1) || (12 < date.month)) return false;
+            if ((*it != L'.') || !parseNumber (++it, 1, date.week) || (date.week < 1) || (5 < date.week)) return false;
+            if ((*it != L'.') || !parseNumber (++it, 1, date.weekday) || (6 < date.weekday)) return false;
+        } else if (*it == L'J') {
+            date.form = Form::Julian;
+            if (!parseNumber (++it, 3, date.day) || (date.day < 1) || (365 < date.day)) return false;
+        } else {
+            date.form = Form::DayOfYear;
+            if (!parseNumber (it, 3, date.day) || (365 < date.day)) return false;
+        }
+
+        return (*it != L'/') || parseTime (++it, date.time);
+    }
+};
+
+//__________________________________________________________________________________________________
+
+class TimeZone {
+    // A time zone, answering offset, abbreviation and daylight saving time queries for any instant.
+    // Zones are loaded once from TZif files in the zoneinfo database, from POSIX TZ rule strings, or
+    // taken from the system local time zone. Transitions loaded from TZif files are kept in a sorted
+    // array and found by binary search, starting with a check of the last transition found.
+
+  public:
+    bool load (const wstring& spec) {
+        // Loads the given time zone, either a zoneinfo name such as `America/Los_Angeles`, or a
+        // POSIX rule such as `PST8PDT`. A leading colon selects a zoneinfo name only. Returns true
+        // on success, false if the zone is not recognized.
+
+        if (spec.empty())
+            return false;
+
+        if (spec[0] == L':')
+            return loadTZif (zoneInfoPath (spec.substr(1)));
+
+        // Rules with an explicit offset take precedence over zoneinfo files, so that for example
+        // `EST5EDT` follows the documented rule. Rules without an offset, such as `UTC` or `EST`,
+        // are looked up in the zoneinfo database first.
+
+        ZoneRule specRule;
+        auto isRule = specRule.parse (spec.c_str());
+
+        if (!(isRule && specRule.hasOffset) && loadTZif (zoneInfoPath (spec)))
+            return true;
+
+        if (!isRule)
+            return false;
+
+        source = Source::Rule;
+        rule   = specRule;
+        return true;
+    }
+
+    void loadSystem () {
+        // Uses the system local time zone, as reported by the C runtime library.
+
+        source = Source::System;
+
+        tm      sample {};
+        wchar_t buffer[64];
+
+        sample.tm_year = 100;
+        sample.tm_mday = 1;
+
+        for (auto isDST = 0;  isDST <= 1;  ++isDST) {
+            sample.tm_isdst = isDST;
+            auto length = wcsftime (buffer, std::size(buffer), L"%Z", &sample);
+            systemNames[isDST].assign (buffer, length);
+        }
+    }
+
+    ZoneInfo lookup (int64_t utcTime) const {
+        // Returns the state of the zone at the given time.
+
+        if (source == Source::System) {
+            bool isDST;
+            auto offset = getSystemOffset (utcTime, isDST);
+            return { offset, isDST, systemNames[isDST].c_str() };
+        }
+
+        if (source == Source::Rule)
+            return rule.lookup (utcTime);
+
+        auto count = transitionTimes.size();
+
+        if (hasRule && ((count == 0) || (transitionTimes.back() <= utcTime)))
+            return rule.lookup (utcTime);
+
+        if ((count == 0) || (utcTime < transitionTimes[0]))
+            return types[0].info();
+
+        // Check the last transition found before searching.
+        auto index = lastTransition.load (std::memory_order_relaxed);
+
+        if ((utcTime < transitionTimes[index]) || ((index + 1 < count) && (transitionTimes[index + 1] <= utcTime))) {
+            auto next = std::upper_bound (transitionTimes.begin(), transitionTimes.end(), utcTime);
+            index = static_cast<size_t>(next - transitionTimes.begin()) - 1;
+            lastTransition.store (index, std::memory_order_relaxed);
+        }
+
+        return types[transitionTypes[index]].info();
+    }
+
+    void localTime (int64_t utcTime, tm& result, ZoneInfo& zone) const {
+        // Sets the given time struct to the local time in this zone for the given number of seconds
+        // since the epoch, along with the zone state at that time.
+
+        zone = lookup (utcTime);
+        tmFromEpoch (utcTime + zone.offset, result);
+        result.tm_isdst = zone.isDST;
+    }
+
+    int64_t utcFromLocal (const tm& localTime) const {
+        // Returns the number of seconds since the epoch for the given local time in this zone,
+        // normalizing any out-of-range fields. Whether daylight saving time is in effect is
+        // determined from the time itself; the tm_isdst field is ignored. As with mktime(), local
+        // times repeated by a backward transition resolve to the later instant, and local times
+        // skipped by a forward transition are read using the offset in effect before it.
+
+        static const int64_t transitionReach = 3 * secondsPerHour;  // Max distance to an adjacent offset
+
+        auto localSeconds = epochFromTm (localTime);
+        auto offset       = lookup(localSeconds - lookup(localSeconds).offset).offset;
+        auto guess        = localSeconds - offset;
+
+        int offsets[3] {
+            offset,
+            lookup(guess - transitionReach).offset,
+            lookup(guess + transitionReach).offset
+        };
+
+        auto result   = INT64_MIN;      // Latest consistent candidate
+        auto fallback = INT64_MIN;      // Latest candidate, used if none are consistent
+
+        for (auto candidateOffset : offsets) {
+            auto candidate = localSeconds - candidateOffset;
+            fallback = std::max (fallback, candidate);
+            if (lookup(candidate).offset == candidateOffset)
+                result = std::max (result, candidate);
+        }
+
+        return (result != INT64_MIN) ? result : fallback;
+    }
+
+  private:
+    enum class Source { System, Rule, TZif };
+
+    class ZoneType {
+        // A local time type from a TZif file.
+      public:
+        int     offset;
+        bool    isDST;
+        wstring abbreviation;
+
+        ZoneInfo info () const { return { offset, isDST, abbreviation.c_str() }; }
+    };
+
+    Source           source  { Source::System };
+    ZoneRule         rule;                      // Rule-based zone, or the TZif rule for later times
+    bool             hasRule { false };         // True if the TZif file has a rule for later times
+    vector<int64_t>  transitionTimes;           // Sorted TZif transition times
+    vector<uint8_t>  transitionTypes;           // Local time type index for each transition
+    vector<ZoneType> types;                     // TZif local time types
+    wstring          systemNames[2];            // System standard and daylight time abbreviations
+
+    mutable std::atomic<size_t> lastTransition { 0 };  // Index of the last transition found
+
+    static wstring zoneInfoPath (const wstring& name) {
+        // Returns the file path for the given zoneinfo name. Absolute paths are used as is. Other
+        // names are found in the directory given by the TZDIR environment variable, or in
+        // /usr/share/zoneinfo.
+
+        auto isAbsolute = !name.empty()
+                       && ((name[0] == L'/') || (name[0] == L'\\') || ((name.length() > 1) && (name[1] == L':')));
+
+        if (isAbsolute)
+            return name;
+
+        wchar_t* zoneDirEnv;
+        _wdupenv_s (&zoneDirEnv, nullptr, L"TZDIR");
+        wstring zoneDir = (zoneDirEnv && *zoneDirEnv) ? zoneDirEnv : L"/usr/share/zoneinfo";
+        free (zoneDirEnv);
+
+        return zoneDir + L'/' + name;
+    }
+
+    bool loadTZif (const wstring& path) {
+        // Loads the TZif (RFC 8536) file at the given path. Returns true on success, false if the
+        // file could not be read or is not a valid TZif file.
+
+        FILE* file;
+        if (0 != _wfopen_s (&file, path.c_str(), L"rb"))
+            return false;
+
+        vector<unsigned char> data;
+        unsigned char         chunk[16384];
+        size_t                length;
+
+        while (0 < (length = fread (chunk, 1, sizeof(chunk), file)))
+            data.insert (data.end(), chunk, chunk + length);
+
+        fclose (file);
+
+        auto size = data.size();
+        auto readInt = [&](size_t offset, size_t bytes) -> int64_t {
+            // Reads a signed big-endian integer of the given size.
+            uint64_t value = (data[offset] & 0x80) ? ~uint64_t(0) : 0;
+            for (size_t i = 0;  i < bytes;  ++i)
+                value = (value << 8) | data[offset + i];
+            return static_cast<int64_t>(value);
+        };
+
+        // Header counts: UT indicators, standard/wall indicators, leap seconds, transitions, local
+        // time types, and abbreviation characters.
+        size_t counts[6];
+        size_t position = 0;
+        size_t timeSize = 4;
+
+        auto readHeader = [&]() -> bool {
+            if ((size < position + 44) || (0 != memcmp (data.data() + position, "TZif", 4)))
+                return false;
+            for (auto i = 0;  i < 6;  ++i)
+                counts[i] = static_cast<size_t>(readInt (position + 20 + 4*i, 4) & 0xffffffff);
+            position += 44;
+            return true;
+        };
+
+        auto blockSize = [&]() {
+            return counts[3] * timeSize + counts[3] + counts[4] * 6 + counts[5]
+                 + counts[2] * (timeSize + 4) + counts[1] + counts[0];
+        };
+
+        if (!readHeader())
+            return false;
+
+        auto version = data[4];
+
+        if (version >= '2') {
+            // Skip the version 1 data block, and use the 64-bit data that follows.
+            position += blockSize();
+            timeSize  = 8;
+            if (!readHeader())
+                return false;
+        }
+
+        auto timeCount = counts[3];
+        auto typeCount = counts[4];
+        auto charCount = counts[5];
+
+        if ((typeCount == 0) || (size < position + blockSize()))
+            return false;
+
+        auto typeIndexes   = position + timeCount * timeSize;
+        auto typeRecords   = typeIndexes + timeCount;
+        auto abbreviations = typeRecords + typeCount * 6;
+
+        vector<int64_t>  newTimes (timeCount);
+        vector<uint8_t>  newTypeIndexes (timeCount);
+        vector<ZoneType> newTypes (typeCount);
+
+        for (size_t i = 0;  i < timeCount;  ++i) {
+            newTimes[i]       = readInt (position + i * timeSize, timeSize);
+            newTypeIndexes[i] = data[typeIndexes + i];
+            if (newTypeIndexes[i] >= typeCount)
+                return false;
+        }
+
+        for (size_t i = 0;  i < typeCount;  ++i) {
+            auto record      = typeRecords + i * 6;
+            auto abbrevIndex = data[record + 5];
+
+            if (abbrevIndex >= charCount)
+                return false;
+
+            auto abbrev = reinterpret_cast<const char*>(data.data() + abbreviations + abbrevIndex);
+            auto abbrevLength = strnlen (abbrev, charCount - abbrevIndex);
+
+            newTypes[i].offset = static_cast<int>(readInt (record, 4));
+            newTypes[i].isDST  = data[record + 4] != 0;
+            newTypes[i].abbreviation.assign (abbrev, abbrev + abbrevLength);
+        }
+
+        // Version 2+ files end with a newline-enclosed POSIX rule for times after the last
+        // transition.
+
+        ZoneRule footerRule;
+        auto     hasFooterRule = false;
+
+        if (version >= '2') {
+            auto footer = position + blockSize();
+            if ((footer < size) && (data[footer] == '\n')) {
+                auto footerEnd = std::find (data.begin() + footer + 1, data.end(), '\n');
+                wstring footerText (data.begin() + footer + 1, footerEnd);
+                hasFooterRule = !footerText.empty() && footerRule.parse (footerText.c_str());
+            }
+        }
+
+        source          = Source::TZif;
+        rule            = footerRule;
+        hasRule         = hasFooterRule;
+        transitionTimes = std::move (newTimes);
+        transitionTypes = std::move (newTypeIndexes);
+        types           = std::move (newTypes);
+        lastTransition  = 0;
+
+        return true;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+class TimeContext {
+    // The state needed to parse and compute time values: the time zone, and a snapshot of the
+    // current time. Fields of explicit times that are not given come from the current time.
+    // Contexts are independent of each other, and once initialized, a context may be shared by any
+    // number of threads, so conversions in different time zones can run concurrently.
+    //
+    // The default time zone is loaded lazily, on first use, so that a context whose zone is set
+    // explicitly never loads the default zone.
+
+  public:
+    TimeZone       zone;                    // Time zone for all local times
+    uint64_t       zoneId { 0 };            // Unique ID of the zone setting, for cached output
+    bool           zoneReady { false };     // The zone has been loaded
+    std::once_flag zoneOnce;                // Guards the lazy load of the default zone
+    Time           currentTime;             // Snapshot of the current time
+    tm             currentTimeLocal {};     // Current time in the context's time zone
+    tm             currentTimeUTC {};       // Current time in UTC
+};
+
+//__________________________________________________________________________________________________
+
+void getCurrentTime (TimeContext& context) {
+    // This function snapshots the current time, with the system clock's full resolution, into the
+    // given context. The corresponding local and UTC time structs are set if the zone is loaded;
+    // otherwise they are set when the zone is loaded.
+
+    timespec now;
+
+    timespec_get (&now, TIME_UTC);
+    context.currentTime = Time (now.tv_sec, static_cast<int32_t>(now.tv_nsec));
+
+    if (context.zoneReady) {
+        ZoneInfo zone;
+        context.zone.localTime (context.currentTime.seconds, context.currentTimeLocal, zone);
+        tmFromEpoch (context.currentTime.seconds, context.currentTimeUTC);
+    }
+}
+
+//__________________________________________________________________________________________________
+
+void markZoneLoaded (TimeContext& context) {
+    // Marks the context's zone as loaded, and sets the current time structs for the new zone.
+
+    static std::atomic<uint64_t> nextZoneId { 1 };     // Source of unique zone setting IDs
+
+    ZoneInfo zone;
+
+    context.zoneId    = nextZoneId++;
+    context.zoneReady = true;
+    context.zone.localTime (context.currentTime.seconds, context.currentTimeLocal, zone);
+    tmFromEpoch (context.currentTime.seconds, context.currentTimeUTC);
+}
+
+//__________________________________________________________________________________________________
+
+void loadDefaultZone (TimeContext& context) {
+    // Loads the zone given by the TZ environment variable if it's one we recognize. Otherwise,
+    // falls back to the system local time zone, which also honors TZ.
+
+    wchar_t* zoneEnv;
+    _wdupenv_s (&zoneEnv, nullptr, L"TZ");
+
+    if (!zoneEnv || !context.zone.load (zoneEnv))
+        context.zone.loadSystem();
+
+    free (zoneEnv);
+    markZoneLoaded (context);
+}
+
+
+//======================================================================================================================
+// Utility Functions
+//======================================================================================================================
+
+bool charIn (wchar_t c, const wchar_t* list) {
+    // Return true if the given character is in the zero-terminated array of characters.
+    // Also returns true if c == 0.
+    auto i = 0;
+    while (list[i] && (c != list[i]))
+        ++i;
+    return (c == list[i]);
+}
+
+//__________________________________________________________________________________________________
+
+int getNumIntDigits (int64_t x) {
+    // Returns the number of digits in the given integer value.
+
+    auto n = x;
+    int nDigits = 1;
+    while (n /= 10)
+        ++ nDigits;
+
+    return nDigits;
+}
+
+
+//======================================================================================================================
+// Date/Time Parsing Functions
+//======================================================================================================================
+
+class ExplicitTime {
+    // The fields of a parsed ISO 8601 explicit time. Any fields not given in the time value take
+    // their values from the current time.
+
+  public:
+    enum class DateForm {
+        None,           // No date
+        Year,           // YYYY
+        YearMonth,      // YYYY=MM
+        YearDay,        // YYYY-DDD
+        MonthDay,       // ==MM-DD
+        YearMonthDay,   // YYYY-MM-DD
+    };
+
+    enum class ZoneForm {
+        Local,          // Local time
+        UTC,            // Z
+        Offset,         // +HH or +HH:MM
+    };
+
+    DateForm dateForm   { DateForm::None };
+    int      year       { 0 };
+    int      month      { 0 };      // Month (1-12)
+    int      day        { 0 };      // Day of month, or day of year for DateForm::YearDay
+
+    int      timeFields  { 0 };     // Time fields given: 0 (none), 1 (HH), 2 (HH:MM) or 3 (HH:MM:SS)
+    int      hour        { 0 };
+    int      minute      { 0 };
+    int      second      { 0 };
+    int      nanoseconds { 0 };     // Fractional seconds, when seconds are given
+
+    ZoneForm zoneForm      { ZoneForm::Local };
+    int      offsetHours   { 0 };   // Signed hours offset from UTC, for ZoneForm::Offset
+    int      offsetMinutes { 0 };   // Signed minutes offset from UTC, for ZoneForm::Offset
+};
+
+//__________________________________________________________________________________________________
+
+class TimeScanner {
+    // A state machine that recognizes the time part of an explicit time value, fed one character at
+    // a time. Times have the form `HH[:MM[:SS[.fff]]]`, where the colons are optional, followed by
+    // an optional time zone of the form `Z`, `+HH` or `+HH[:]MM`. Fractional seconds follow a `.` or
+    // `,`, and are kept to nanosecond resolution; any further digits are ignored.
+
+  public:
+    bool step (int c) {
+        // Consumes the next character. Returns false if the character cannot continue the time.
+
+        auto isDigit = ('0' <= c) && (c <= '9');
+
+        switch (state) {
+            case State::Time:
+            case State::TimeColon:
+                if (isDigit && (digits < 6)) {
+                    fields[digits / 2] = 10 * fields[digits / 2] + (c - '0');
+                    ++digits;
+                    state = State::Time;
+                    return true;
+                }
+
+                // Separators may only follow a complete field.
+                if ((state != State::Time) || (digits == 0) || (digits % 2 != 0))
+                    break;
+
+                if ((c == ':') && (digits < 6)) {
+                    state = State::TimeColon;
+                    return true;
+                }
+
+                if (((c == '.') || (c == ',')) && (digits == 6)) {
+                    state = State::FractionPoint;
+                    return true;
+                }
+
+                if (stepZone (c))
+                    return true;
+                break;
+
+            case State::Fraction:
+            case State::FractionPoint:
+                if (isDigit) {
+                    if (fractionDigits < 9) {
+                        nanoseconds = 10 * nanoseconds + (c - '0');
+                        ++fractionDigits;
+                    }
+                    state = State::Fraction;
+                    return true;
+                }
+
+                if ((state == State::Fraction) && stepZone (c))
+                    return true;
+                break;
+
+            case State::Offset:
+            case State::OffsetColon:
+                if (isDigit && (offsetDigits < 4)) {
+                    offsetFields[offsetDigits / 2] = 10 * offsetFields[offsetDigits / 2] + (c - '0');
+                    ++offsetDigits;
+                    state = State::Offset;
+                    return true;
+                }
+
+                if ((c == ':') && (state == State::Offset) && (offsetDigits == 2)) {
+                    state = State::OffsetColon;
+                    return true;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        state = State::Dead;
+        return false;
+    }
+
+    bool accepts () const {
+        // Returns true if the characters consumed so far form a complete time.
+        switch (state) {
+            case State::Time:    return (digits > 0) && (digits % 2 == 0);
+            case State::Fraction:
+            case State::Zulu:    return true;
+            case State::Offset:  return (offsetDigits == 2) || (offsetDigits == 4);
+            default:             return false;
+        }
+    }
+
+    void getResult (ExplicitTime& result) const {
+        // Stores the recognized time in the given result.
+
+        result.timeFields = digits / 2;
+        result.hour       = fields[0];
+        result.minute     = fields[1];
+        result.second     = fields[2];
+
+        result.nanoseconds = nanoseconds;
+        for (int i = fractionDigits;  i < 9;  ++i)
+            result.nanoseconds *= 10;
+
+        if (state == State::Zulu) {
+            result.zoneForm = ExplicitTime::ZoneForm::UTC;
+        } else if (state == State::Offset) {
+            result.zoneForm      = ExplicitTime::ZoneForm::Offset;
+            result.offsetHours   = offsetSign * offsetFields[0];
+            result.offsetMinutes = offsetSign * offsetFields[1];
+        }
+    }
+
+  private:
+    enum class State { Time, TimeColon, FractionPoint, Fraction, Zulu, Offset, OffsetColon, Dead };
+
+    State state        { State::Time };
+    int   digits       { 0 };               // Time digits consumed
+    int   fields[3]    { 0, 0, 0 };         // Hours, minutes & seconds
+    int   fractionDigits { 0 };             // Fractional second digits kept, up to nine
+    int   nanoseconds  { 0 };               // Fractional second digits, as an integer
+    int   offsetSign   { 1 };
+    int   offsetDigits { 0 };               // Time zone offset digits consumed
+    int   offsetFields[2] { 0, 0 };         // Time zone offset hours & minutes
+
+    bool stepZone (int c) {
+        // Consumes the start of a time zone following a complete time. Returns false if the
+        // character does not start a time zone.
+
+        if (c == 'Z') {
+            state = State::Zulu;
+            return true;
+        }
+
+        if ((c == '+') || (c == '-')) {
+            offsetSign = (c == '-') ? -1 : 1;
+            state = State::Offset;
+            return true;
+        }
+
+        return false;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+class DateScanner {
+    // A state machine that recognizes the date part of an explicit time value, fed one character at
+    // a time. Dates have one of the forms `YYYY-MM-DD`, `YYYY=MM`, `YYYY`, `==MM-DD` or `YYYY-DDD`,
+    // where `-` is an optional dash and `=` is a required dash.
+
+  public:
+    bool step (int c) {
+        // Consumes the next character. Returns false if the character cannot continue the date.
+
+        auto isDigit = ('0' <= c) && (c <= '9');
+
+        switch (state) {
+            case State::Start:
+                if (isDigit) {
+                    state = State::Year;
+                    return addDigit (year, yearDigits, 4, c);
+                }
+                if (c == '-') {
+                    state = State::LeadDash;
+                    return true;
+                }
+                break;
+
+            case State::LeadDash:
+                if (c == '-') {
+                    state = State::MonthDay;
+                    return true;
+                }
+                break;
+
+            case State::MonthDay:       // ==MM-DD
+                if (isDigit) {
+                    dashPending = false;
+                    if (secondDash)
+                        return addDigit (last, lastDigits, 2, c);
+                    return addDigit (rest, restDigits, 4, c);
+                }
+                if ((c == '-') && (restDigits == 2) && !secondDash) {
+                    secondDash = dashPending = true;
+                    return true;
+                }
+                break;
+
+            case State::Year:           // YYYY followed by -MM-DD, =MM or -DDD
+                if (isDigit) {
+                    dashPending = false;
+                    if (yearDigits < 4)
+                        return addDigit (year, yearDigits, 4, c);
+                    if (secondDash)
+                        return addDigit (last, lastDigits, 2, c);
+                    return addDigit (rest, restDigits, 4, c);
+                }
+                if ((c == '-') && (yearDigits == 4) && (restDigits == 0) && !yearDash) {
+                    yearDash = dashPending = true;
+                    return true;
+                }
+                if ((c == '-') && (restDigits == 2) && !secondDash && !dashPending) {
+                    secondDash = dashPending = true;
+                    return true;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        state = State::Dead;
+        return false;
+    }
+
+    bool accepts () const {
+        // Returns true if the characters consumed so far form a complete date.
+        return form() != ExplicitTime::DateForm::None;
+    }
+
+    void getResult (ExplicitTime& result) const {
+        // Stores the recognized date in the given result.
+
+        result.dateForm = form();
+        result.year     = year;
+
+        switch (result.dateForm) {
+            case ExplicitTime::DateForm::YearMonth:
+                result.month = rest;
+                break;
+
+            case ExplicitTime::DateForm::YearDay:
+                result.day = rest;
+                break;
+
+            case ExplicitTime::DateForm::MonthDay:
+            case ExplicitTime::DateForm::YearMonthDay:
+                result.month = (restDigits == 4) ? rest / 100 : rest;
+                result.day   = (restDigits == 4) ? rest % 100 : last;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+  private:
+    enum class State { Start, LeadDash, MonthDay, Year, Dead };
+
+    State state       { State::Start };
+    int   year        { 0 };
+    int   yearDigits  { 0 };
+    int   rest        { 0 };        // Digits following the year (or leading dashes), before any second dash
+    int   restDigits  { 0 };
+    int   last        { 0 };        // Day digits following a second dash
+    int   lastDigits  { 0 };
+    bool  yearDash    { false };    // A dash followed the year
+    bool  secondDash  { false };    // A dash separates the month and day
+    bool  dashPending { false };    // The last character consumed was a dash
+
+    static bool addDigit (int& value, int& digits, int maxDigits, int c) {
+        if (digits >= maxDigits) return false;
+        value = 10 * value + (c - '0');
+        ++digits;
+        return true;
+    }
+
+    ExplicitTime::DateForm form () const {
+        using DateForm = ExplicitTime::DateForm;
+
+        if (dashPending) return DateForm::None;
+
+        if (state == State::MonthDay) {
+            if (secondDash ? (lastDigits == 2) : (restDigits == 4))
+                return DateForm::MonthDay;
+        } else if ((state == State::Year) && (yearDigits == 4)) {
+            if (secondDash)                    return (lastDigits == 2) ? DateForm::YearMonthDay : DateForm::None;
+            if (restDigits == 0 && !yearDash)  return DateForm::Year;
+            if (restDigits == 2 &&  yearDash)  return DateForm::YearMonth;
+            if (restDigits == 3)               return DateForm::YearDay;
+            if (restDigits == 4)               return DateForm::YearMonthDay;
+        }
+
+        return DateForm::None;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+template <typename CharT>
+bool parseExplicitTime (
+    const CharT*  specBegin,      // Start of the explicit time string
+    const CharT*  specEnd,        // End of the explicit time string
+    ExplicitTime& result,         // Output parsed time fields
+    size_t&       errorIndex)     // Output index of the first unrecognized character, on failure
+{
+    // Parses an ISO 8601 explicit time value in a single pass, without allocation. If the string
+    // contains a `T`, then it is a date followed by a time. Otherwise it is either a time or a date,
+    // with time taking precedence. Both interpretations are tracked at once, so each character is
+    // examined only once. Returns true on success, false on failure.
+
+    TimeScanner timeOnly;           // Interpretation as a time alone
+    DateScanner date;               // Interpretation as a date, optionally followed by `T` and a time
+    TimeScanner dateTime;           // Time following the date and `T`
+
+    auto   length        = static_cast<size_t>(specEnd - specBegin);
+    auto   inDateTime    = false;   // The date interpretation has passed the `T` separator
+    auto   timeOnlyAlive = true;
+    auto   dateAlive     = true;
+    size_t timeOnlyError = length;
+    size_t dateError     = length;
+
+    for (size_t i = 0;  (i < length) && (timeOnlyAlive || dateAlive);  ++i) {
+        int c = specBegin[i];
+
+        if (timeOnlyAlive && !timeOnly.step(c)) {
+            timeOnlyAlive = false;
+            timeOnlyError = i;
+        }
+
+        if (dateAlive) {
+            auto ok = inDateTime ? dateTime.step(c)
+                    : (c == 'T') ? (inDateTime = date.accepts())
+                    : date.step(c);
+
+            if (!ok) {
+                dateAlive = false;
+                dateError = i;
+            }
+        }
+    }
+
+    result = ExplicitTime();
+
+    if (timeOnlyAlive && timeOnly.accepts()) {
+        timeOnly.getResult (result);
+        return true;
+    }
+
+    if (dateAlive && date.accepts() && (!inDateTime || dateTime.accepts())) {
+        date.getResult (result);
+        if (inDateTime)
+            dateTime.getResult (result);
+        return true;
+    }
+
+    errorIndex = std::max (timeOnlyError, dateError);
+    return false;
+}
+
+//__________________________________________________________________________________________________
+
+int64_t applyExplicitTime (tm& timeStruct, const ExplicitTime& time, const TimeZone& zone) {
+    // Sets the date and time fields of the given time struct from the parsed explicit time, and
+    // returns the corresponding number of seconds since the epoch. Fields not given in the explicit
+    // time keep their existing values. Out-of-range fields are normalized. Local times are in the
+    // given time zone.
+
+    using DateForm = ExplicitTime::DateForm;
+    using ZoneForm = ExplicitTime::ZoneForm;
+
+    switch (time.dateForm) {
+        case DateForm::Year:
+            timeStruct.tm_year = time.year - 1900;
+            break;
+
+        case DateForm::YearMonth:
+            timeStruct.tm_year = time.year - 1900;
+            timeStruct.tm_mon  = time.month - 1;
+            break;
+
+        case DateForm::YearDay:
+            timeStruct.tm_year = time.year - 1900;
+            timeStruct.tm_mon  = 0;
+            timeStruct.tm_mday = time.day;
+            break;
+
+        case DateForm::MonthDay:
+            timeStruct.tm_mon  = time.month - 1;
+            timeStruct.tm_mday = time.day;
+            break;
+
+        case DateForm::YearMonthDay:
+            timeStruct.tm_year = time.year - 1900;
+            timeStruct.tm_mon  = time.month - 1;
+            timeStruct.tm_mday = time.day;
+            break;
+
+        default:
+            break;
+    }
+
+    if (time.timeFields >= 1)  timeStruct.tm_hour = time.hour;
+    if (time.timeFields >= 2)  timeStruct.tm_min  = time.minute;
+    if (time.timeFields >= 3)  timeStruct.tm_sec  = time.second;
+
+    switch (time.zoneForm) {
+        case ZoneForm::UTC:
+            return epochFromTm (timeStruct);
+
+        case ZoneForm::Offset:
+            return epochFromTm (timeStruct)
+                 - int64_t(time.offsetHours) * secondsPerHour - int64_t(time.offsetMinutes) * secondsPerMinute;
+
+        default:
+            return zone.utcFromLocal (timeStruct);
+    }
+}
+
+//__________________________________________________________________________________________________
+
+template <typename CharT>
+bool getExplicitDateTime (
+    const TimeContext& context,     // Time zone and current time
+    Time&              result,      // Output time value
+    const CharT*       specBegin,   // Start of the explicit time string
+    const CharT*       specEnd,     // End of the explicit time string
+    size_t&            errorIndex)  // Output index of the first unrecognized character, on failure
+{
+    // Parses an ISO 8601 formatted date/time string, given as a span of either narrow or wide
+    // characters. Returns true on success. On failure, returns false and sets errorIndex to the
+    // index of the first unrecognized character. As with the other fields, fractional seconds come
+    // from the current time unless seconds are given.
+
+    ExplicitTime explicitTime;
+
+    if (!parseExplicitTime (specBegin, specEnd, explicitTime, errorIndex))
+        return false;
+
+    tm timeStruct = context.currentTimeLocal;
+    result.seconds     = applyExplicitTime (timeStruct, explicitTime, context.zone);
+    result.nanoseconds = (explicitTime.timeFields >= 3) ? explicitTime.nanoseconds : context.currentTime.nanoseconds;
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+Time timeDifference (Time time1, Time time2) {
+    // Returns the absolute difference between the two times.
+
+    auto seconds     = time2.seconds - time1.seconds;
+    auto nanoseconds = time2.nanoseconds - time1.nanoseconds;
+
+    if ((seconds < 0) || ((seconds == 0) && (nanoseconds < 0))) {
+        seconds     = -seconds;
+        nanoseconds = -nanoseconds;
+    }
+
+    if (nanoseconds < 0) {
+        nanoseconds += nanosecondsPerSecond;
+        --seconds;
+    }
+
+    return Time (seconds, nanoseconds);
+}
+
+//__________________________________________________________________________________________________
+
+void calcResult (
+    const TimeContext& context,           // Time zone for local times
+    Time               time1,             // Primary time value
+    Time               time2,             // Secondary time value, used only for time differences
+    bool               isDelta,           // Report the difference between the two times
+    tm&                timeValue,         // Output time value
+    int32_t&           nanoseconds,       // Output fractional seconds of the time value
+    ZoneInfo&          zone,              // Output time zone state for the time value
+    Time&              deltaTime)         // Output time delta
+{
+    // Computes the time value and time delta to report from the given time values. Time deltas are
+    // reported in UTC.
+
+    if (!isDelta) {                                 // Reporting a single absolute time.
+        deltaTime = Time();
+        context.zone.localTime (time1.seconds, timeValue, zone);
+        nanoseconds = time1.nanoseconds;
+    } else {                                        // Reporting a time diffence
+        deltaTime = timeDifference (time1, time2);
+        tmFromEpoch (deltaTime.seconds, timeValue);
+        nanoseconds = deltaTime.nanoseconds;
+        zone = ZoneInfo();
+    }
+}
+
+
+//======================================================================================================================
+// Format Compilation
+//======================================================================================================================
+
+enum class FormatOpType {
+    // Types of operations in a compiled format plan
+
+    Literal,    // Emit a run of literal characters
+    TimeCode,   // Emit a wcsftime() code sequence
+    ZoneOffset, // Emit the time zone offset from UTC (%z)
+    ZoneName,   // Emit the time zone abbreviation (%Z)
+    Name,       // Emit a locale day, month or AM/PM name, truncated to a given length (%a, %<d>a, ...)
+    Fraction,   // Emit fractional seconds, truncated to a given number of digits (%<d>N)
+    Delta,      // Emit a delta time value (%_...)
+};
+
+class FormatOp {
+    // A single operation in a compiled format plan.
+
+  public:
+    FormatOpType type;
+    size_t       index;     // Literal & TimeCode: offset into plan text; Delta: index into plan deltas
+    size_t       length;    // Literal: number of characters; Name: maximum name length; Fraction: digits
+};
+
+enum class NameType {
+    // Types of locale names, indexing the name tables of LocaleNames
+
+    WeekdayShort,   // %a
+    Weekday,        // %A, %<d>a
+    MonthShort,     // %b, %h
+    Month,          // %B
+    AmPm,           // %p
+};
+
+enum class DeltaModulo {
+    // Modulo units of delta time formats, indexing the remainders of a DeltaTime
+
+    None,           // No modulo unit; the full time difference
+    Year,           // Modulo nominal year (y)
+    TropicalYear,   // Modulo tropical year (t)
+    Day,            // Modulo day (d)
+    Hour,           // Modulo hour (h)
+    Minute,         // Modulo minute (m)
+    Second,         // Modulo second (s)
+    Count
+};
+
+class DeltaTime {
+    // A time difference decomposed into its remainder modulo each delta modulo unit. This is
+    // computed once per render, and shared by all delta time codes in the format.
+
+  public:
+    int64_t remainder [static_cast<int>(DeltaModulo::Count)];     // Whole seconds, by modulo unit
+    int32_t nanoseconds;                                          // Fractional seconds
+};
+
+class DeltaSpec {
+    // A pre-parsed delta time format, of the form `%_['kd][u[0]]<U>[.[#]]`. Unit sizes are kept in
+    // nanoseconds, so that sub-second units are exact.
+
+  public:
+    wchar_t     thousandsChar { 0 };      // Thousands-separator character, 0=none
+    wchar_t     decimalChar   { 0 };      // Decimal character, 0=default '.'
+    wchar_t     moduloUnit    { 0 };      // Next greater unit, 0=none
+    int64_t     moduloValue   { 0 };      // Nanoseconds per next greater unit
+    DeltaModulo modulo        { DeltaModulo::None };    // Next greater unit, as a DeltaTime index
+    wchar_t     unitType      { 0 };      // Delta unit
+    int64_t     unitValue     { 1 };      // Nanoseconds per delta unit
+    int         leadingZeros  { 0 };      // Zero-padded field width, 0=none
+    int         precision     { 0 };      // Output decimal precision
+    bool        wholeValue    { true };   // Round down to whole value (no decimal precision requested)
+};
+
+class FormatPlan {
+    // A format string compiled into a sequence of output operations. Format strings are parsed
+    // once into a plan, and each time value is then rendered by walking the plan.
+
+  public:
+    wstring           text;     // Zero-terminated literal runs and wcsftime() codes
+    vector<FormatOp>  ops;      // Output operations, in order
+    vector<DeltaSpec> deltas;   // Delta time formats referenced by Delta ops
+};
+
+//__________________________________________________________________________________________________
+
+bool getDeltaNumberFormat (
+    wstring::const_iterator&       formatIterator,
+    const wstring::const_iterator& formatEnd,
+    wchar_t& thousandsChar,
+    wchar_t& decimalChar)
+{
+    // This function parses the thousands separator and decimal point formatting sequence, if it
+    // exists. On return, `thousandsChar` will contain the thousands character, or zero if no
+    // thousands character is to be printed, and `decimalChar` will contain the decimal character to
+    // use, or 0 to use a '.' decimal point.
+
+    thousandsChar = 0;
+    decimalChar = 0;
+
+    if (*formatIterator == L'\'') {
+        if (++formatIterator == formatEnd) return false;
+        thousandsChar = *formatIterator;
+        if (++formatIterator == formatEnd) return false;
+        decimalChar = *formatIterator;
+        if (++formatIterator == formatEnd) return false;
+
+        if (thousandsChar == L'0')    // '0' indicates no thousands character.
+            thousandsChar = 0;
+    }
+
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+bool parseDeltaFormat (
+    wstring::const_iterator&       formatIterator,   // Pointer to delta format after '%_'
+    const wstring::const_iterator& formatEnd,        // Format string end
+    DeltaSpec&                     delta)            // Output parsed delta format
+{
+    // Parses a delta time format. Returns true on success, leaving the format iterator just past
+    // the delta format. On failure, returns false with the format iterator in an unspecified state.
+
+    if (formatIterator == formatEnd) return false;
+
+    if (!getDeltaNumberFormat (formatIterator, formatEnd, delta.thousandsChar, delta.decimalChar))
+        return false;
+
+    // Parse modulo unit, if one exists.
+    delta.moduloUnit = *formatIterator++;
+
+    switch (delta.moduloUnit) {
+        case L'y':  delta.moduloValue = secondsPerNominalYear;   delta.modulo = DeltaModulo::Year;          break;
+        case L't':  delta.moduloValue = secondsPerTropicalYear;  delta.modulo = DeltaModulo::TropicalYear;  break;
+        case L'd':  delta.moduloValue = secondsPerDay;           delta.modulo = DeltaModulo::Day;           break;
+        case L'h':  delta.moduloValue = secondsPerHour;          delta.modulo = DeltaModulo::Hour;          break;
+        case L'm':  delta.moduloValue = secondsPerMinute;        delta.modulo = DeltaModulo::Minute;        break;
+        case L's':  delta.moduloValue = 1;                       delta.modulo = DeltaModulo::Second;        break;
+
+        default:
+            delta.moduloUnit = 0;
+            --formatIterator;
+            break;
+    }
+
+    delta.moduloValue *= nanosecondsPerSecond;
+
+    // Parse delta unit.
+
+    if (formatIterator == formatEnd) return false;
+
+    auto moduloUnit = delta.moduloUnit;
+    auto unitType = *formatIterator++;
+    auto leadingZeros = (moduloUnit && (unitType == '0')) ? 1 : 0;
+
+    if (leadingZeros) {
+        if (formatIterator == formatEnd) return false;
+        unitType = *formatIterator++;
+    }
+
+    switch (unitType) {
+        case L'Y': {
+            if (moduloUnit != 0) return false; // There are no legal modulo unit prefixes for year.
+            delta.unitValue = int64_t(secondsPerNominalYear) * nanosecondsPerSecond;
+            break;
+        }
+
+        case L'T': {
+            if (moduloUnit != 0) return false; // There are no legal modulo unit prefixes for year.
+            delta.unitValue = int64_t(secondsPerTropicalYear) * nanosecondsPerSecond;
+            break;
+        }
+
+        case L'D': {
+            if (!charIn(moduloUnit, L"ty")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = int64_t(secondsPerDay) * nanosecondsPerSecond;
+            break;
+        }
+
+        case L'H': {
+            if (!charIn(moduloUnit, L"tyd")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = int64_t(secondsPerHour) * nanosecondsPerSecond;
+            break;
+        }
+
+        case L'M': {
+            if (!charIn(moduloUnit, L"tydh")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = int64_t(secondsPerMinute) * nanosecondsPerSecond;
+            break;
+        }
+
+        case L'S': {
+            if (!charIn(moduloUnit, L"tydhm")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = nanosecondsPerSecond;
+            break;
+        }
+
+        case L'L': {
+            if (!charIn(moduloUnit, L"tydhms")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = nanosecondsPerSecond / 1000;
+            break;
+        }
+
+        case L'U': {
+            if (!charIn(moduloUnit, L"tydhms")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = nanosecondsPerSecond / 1000000;
+            break;
+        }
+
+        case L'N': {
+            if (!charIn(moduloUnit, L"tydhms")) return false; // Filter out invalid modulo unit prefixes.
+            delta.unitValue = 1;
+            break;
+        }
+
+        default: return false;
+    }
+
+    delta.unitType = unitType;
+
+    // The field width is the number of digits in the largest value below the modulo unit.
+    if (leadingZeros)
+        delta.leadingZeros = getNumIntDigits (delta.moduloValue / delta.unitValue - 1);
+
+    // Determine the precision of the output value.
+
+    delta.precision  = 0;
+    delta.wholeValue = true;
+
+    auto hasPoint  = (formatIterator != formatEnd) && (*formatIterator == L'.');
+    auto hasDigits = hasPoint && (std::next(formatIterator) != formatEnd) && iswdigit(formatIterator[1]);
+
+    if (unitType == L'N') {
+        // Nanoseconds have no fractional value.
+    } else if ((unitType == L'S') && !hasDigits) {
+        // Seconds have a fractional value only with an explicit precision. A bare trailing '.' is
+        // not part of the format, so `%_S.` prints whole seconds followed by a period.
+    } else if (hasPoint) {
+        delta.wholeValue = false;
+        ++formatIterator;
+        if (!hasDigits) {
+            switch (unitType) {
+                case L'T':
+                case L'Y': delta.precision = 8; break;
+                case L'D': delta.precision = 5; break;
+                case L'H': delta.precision = 4; break;
+                case L'M': delta.precision = 2; break;
+                case L'L': delta.precision = 6; break;
+                case L'U': delta.precision = 3; break;
+            }
+        } else {
+            while ((formatIterator != formatEnd) && iswdigit(*formatIterator))
+                delta.precision = 10*delta.precision + (*formatIterator++ - L'0');
+        }
+    }
+
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+class FormatCompiler {
+    // Helper to accumulate the operations of a format plan under construction. Adjacent literal
+    // characters are coalesced into a single literal run.
+
+  public:
+    FormatPlan plan;
+
+    void addLiteral (wchar_t c) {
+        pendingLiteral += c;
+    }
+
+    void addTimeCode (const wchar_t* code) {
+        flushLiteral();
+        plan.ops.push_back ({ FormatOpType::TimeCode, addText(code), 0 });
+    }
+
+    void addZoneOffset () {
+        flushLiteral();
+        plan.ops.push_back ({ FormatOpType::ZoneOffset, 0, 0 });
+    }
+
+    void addZoneName () {
+        flushLiteral();
+        plan.ops.push_back ({ FormatOpType::ZoneName, 0, 0 });
+    }
+
+    void addName (NameType type, size_t length = SIZE_MAX) {
+        flushLiteral();
+        plan.ops.push_back ({ FormatOpType::Name, static_cast<size_t>(type), length });
+    }
+
+    void addFraction (size_t digits) {
+        flushLiteral();
+        plan.ops.push_back ({ FormatOpType::Fraction, 0, digits });
+    }
+
+    void addDelta (const DeltaSpec& delta) {
+        flushLiteral();
+        plan.ops.push_back ({ FormatOpType::Delta, plan.deltas.size(), 0 });
+        plan.deltas.push_back (delta);
+    }
+
+    void flushLiteral () {
+        if (pendingLiteral.empty()) return;
+        plan.ops.push_back ({ FormatOpType::Literal, addText(pendingLiteral), pendingLiteral.length() });
+        pendingLiteral.clear();
+    }
+
+  private:
+    wstring pendingLiteral;
+
+    size_t addText (const wstring& str) {
+        // Appends the zero-terminated string to the plan text, and returns its offset.
+        auto offset = plan.text.length();
+        plan.text += str;
+        plan.text += L'\0';
+        return offset;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+FormatPlan compileFormat (
+    const wstring& format,      // The format string, possibly with escape sequences and format codes
+    wchar_t        codeChar)    // The format code character (normally %)
+{
+    // This function scans through the format string, resolving escape sequences and format codes
+    // into a format plan.
+
+    const static auto legalCodes = L"aAbBcCdDeFgGhHiIjmMnNprRStTuUVwWxXyYzZ";
+
+    FormatCompiler compiler;
+
+    auto formatIterator = format.cbegin();
+    auto formatEnd      = format.cend();
+
+    while (formatIterator != formatEnd) {
+        auto c = *formatIterator++;
+
+        // Handle backslash sequences, unless backslash is the alternate escape character.
+
+        if ((c == L'\\') && (codeChar != L'\\')) {
+
+            // If the string ends with a \, then just emit the \.
+            if (formatIterator == formatEnd) {
+                compiler.addLiteral (L'\\');
+                continue;
+            }
+
+            switch (c = *formatIterator++) {
+
+                // Recognized \-sequences are handled here.
+                case L'n':  compiler.addLiteral (L'\n');  break;
+                case L't':  compiler.addLiteral (L'\t');  break;
+                case L'b':  compiler.addLiteral (L'\b');  break;
+                case L'r':  compiler.addLiteral (L'\r');  break;
+                case L'a':  compiler.addLiteral (L'\a');  break;
+
+                // Unrecognized \-sequences resolve to the escaped character.
+                default:
+                    compiler.addLiteral (c);
+                    break;
+            }
+
+        } else if (c != codeChar) {
+            // All unescaped characters are emitted as-is.
+            compiler.addLiteral (c);
+
+        } else if (formatIterator == formatEnd) {
+            // A trailing code character is emitted as-is.
+            compiler.addLiteral (codeChar);
+
+        } else if (*formatIterator == L'_') {
+
+            // Delta time format. If the format is bad, then emit the code character and underscore
+            // as-is and continue after them.
+
+            auto deltaIterator = ++formatIterator;
+            DeltaSpec delta;
+
+            if (parseDeltaFormat (deltaIterator, formatEnd, delta)) {
+                compiler.addDelta (delta);
+                formatIterator = deltaIterator;
+            } else {
+                compiler.addLiteral (codeChar);
+                compiler.addLiteral (L'_');
+            }
+
+        } else if (*formatIterator == L'-' || iswdigit(*formatIterator)) {
+            // Numeric prefixed code.
+            auto saveMark = formatIterator;     // Mark start in case of parse error.
+
+            auto numPrefix = 0;
+            auto numSign = 1;
+            if (*formatIterator == L'-') {
+                ++formatIterator;
+                numSign = -1;
+            }
+
+            // Get the leading integer value before the code.
+            while ((formatIterator != formatEnd) && iswdigit(*formatIterator))
+                numPrefix = (10 * numPrefix) + (*formatIterator++ - L'0');
+
+            numPrefix *= numSign;
+
+            const static auto legalPrefixedCodes = L"aN";
+            if (  formatIterator == formatEnd || !wcschr(legalPrefixedCodes, *formatIterator) || numPrefix < 1
+               || (*formatIterator == L'N' && numPrefix > 9)) {
+                // If the string ended without a code character, or it's not a code that can take a
+                // numeric prefix, or the prefix is out of range, then reset and just emit without
+                // interpretation.
+                formatIterator = saveMark;
+                compiler.addLiteral (codeChar);
+                compiler.addLiteral (*formatIterator++);
+            } else if (*formatIterator == L'N') {
+                compiler.addFraction (numPrefix);
+                ++formatIterator;
+            } else {
+                compiler.addName (NameType::Weekday, numPrefix);
+                ++formatIterator;
+            }
+
+        } else if (*formatIterator == codeChar) {
+            compiler.addLiteral (codeChar);
+            ++formatIterator;
+
+        } else if (*formatIterator == L'#') {
+
+            if (std::next(formatIterator) == formatEnd) {
+                // A trailing '#' flag is emitted as-is.
+                compiler.addLiteral (codeChar);
+                compiler.addLiteral (*formatIterator++);
+            } else if (!wcschr(legalCodes, formatIterator[1])) {
+                // Print out illegal '#'-prefixed codes as-is.
+                compiler.addLiteral (codeChar);
+                compiler.addLiteral (*formatIterator++);
+                compiler.addLiteral (*formatIterator++);
+            } else if (formatIterator[1] == L'z') {
+                compiler.addZoneOffset();
+                formatIterator += 2;
+            } else if (formatIterator[1] == L'Z') {
+                compiler.addZoneName();
+                formatIterator += 2;
+            } else if (formatIterator[1] == L'N') {
+                compiler.addFraction (9);
+                formatIterator += 2;
+            } else {
+                const wchar_t token[] = { L'%', L'#', formatIterator[1], 0 };
+                compiler.addTimeCode (token);
+                formatIterator += 2;
+            }
+
+        } else if (!wcschr(legalCodes, *formatIterator)) {
+            // Print out illegal codes as-is.
+            compiler.addLiteral (codeChar);
+            compiler.addLiteral (*formatIterator++);
+
+        } else {
+            // Standard legal strftime() code sequences. Special characters are resolved now, and
+            // `%i` expands to its full ISO-8601 equivalent. Time zone codes are handled directly,
+            // since the C runtime library doesn't know about our time zone, and fractional seconds
+            // are handled directly, since struct tm has none. Day, month and AM/PM names come from
+            // the locale name tables.
+
+            switch (c = *formatIterator++) {
+                case L'n':  compiler.addLiteral (L'\n');  break;
+                case L't':  compiler.addLiteral (L'\t');  break;
+                case L'z':  compiler.addZoneOffset();      break;
+                case L'Z':  compiler.addZoneName();        break;
+                case L'N':  compiler.addFraction (9);      break;
+
+                case L'a':  compiler.addName (NameType::WeekdayShort);  break;
+                case L'A':  compiler.addName (NameType::Weekday);       break;
+                case L'b':
+                case L'h':  compiler.addName (NameType::MonthShort);    break;
+                case L'B':  compiler.addName (NameType::Month);         break;
+                case L'p':  compiler.addName (NameType::AmPm);          break;
+
+                case L'i':
+                    compiler.addTimeCode (L"%FT%T");
+                    compiler.addZoneOffset();
+                    break;
+
+                default: {
+                    const wchar_t token[] = { L'%', c, 0 };
+                    compiler.addTimeCode (token);
+                    break;
+                }
+            }
+        }
+    }
+
+    compiler.flushLiteral();
+    return compiler.plan;
+}
+
+
+//======================================================================================================================
+// Delta Time Printing
+//======================================================================================================================
+
+DeltaTime decomposeDelta (Time deltaTime) {
+    // Decomposes the time difference into its remainder modulo each delta modulo unit. Each
+    // smaller unit evenly divides the nominal year, so the remainders are taken in a chain.
+
+    auto deltaTimeSeconds = deltaTime.seconds;
+
+    DeltaTime delta;
+    auto remainder = [&delta](DeltaModulo modulo) -> int64_t& {
+        return delta.remainder[static_cast<int>(modulo)];
+    };
+
+    delta.nanoseconds = deltaTime.nanoseconds;
+
+    remainder(DeltaModulo::None)         = deltaTimeSeconds;
+    remainder(DeltaModulo::Year)         = deltaTimeSeconds % secondsPerNominalYear;
+    remainder(DeltaModulo::TropicalYear) = deltaTimeSeconds % secondsPerTropicalYear;
+    remainder(DeltaModulo::Day)          = remainder(DeltaModulo::Year) % secondsPerDay;
+    remainder(DeltaModulo::Hour)         = remainder(DeltaModulo::Day) % secondsPerHour;
+    remainder(DeltaModulo::Minute)       = remainder(DeltaModulo::Hour) % secondsPerMinute;
+    remainder(DeltaModulo::Second)       = 0;
+
+    return delta;
+}
+
+//__________________________________________________________________________________________________
+
+void printDelta (
+    wstring&         output,            // Output destination
+    const DeltaSpec& delta,             // Parsed delta time format
+    const DeltaTime& deltaTime)         // Decomposed time difference
+{
+    // Prints the time difference according to the given delta time format. Time differences are
+    // never negative, and all units are whole numbers of nanoseconds, so the scaled value is
+    // computed exactly in integer arithmetic. Digits, padding, thousands separators and the decimal
+    // character are then appended to the output in a single pass.
+
+    auto seconds     = deltaTime.remainder[static_cast<int>(delta.modulo)];
+    auto nanoseconds = deltaTime.nanoseconds;
+    auto unitValue   = delta.unitValue;
+
+    // Split the value into whole units and a fraction of a unit. Counts of sub-second units can
+    // exceed 64 bits, so these are kept as whole seconds plus the units past the second.
+
+    int64_t whole;                  // Whole units, or whole seconds for sub-second units
+    int64_t subUnits       = 0;     // Whole units past the second, for sub-second units
+    int64_t unitsPerSecond = 0;     // Units per second for sub-second units, otherwise zero
+    int64_t fraction;               // Fractional part, in units of 1/unitValue
+
+    if (unitValue >= nanosecondsPerSecond) {
+        auto unitSeconds = unitValue / nanosecondsPerSecond;
+        whole    = seconds / unitSeconds;
+        fraction = (seconds % unitSeconds) * nanosecondsPerSecond + nanoseconds;
+    } else {
+        unitsPerSecond = nanosecondsPerSecond / unitValue;
+        whole    = seconds;
+        subUnits = nanoseconds / unitValue;
+        fraction = nanoseconds % unitValue;
+    }
+
+    auto precision = delta.wholeValue ? 0 : delta.precision;
+
+    // Values are rounded half up to the requested precision. Rounding carries into the whole part
+    // only if the fraction is within half of the last digit of one, which can't happen once the
+    // precision scale exceeds the unit size.
+
+    if (!delta.wholeValue) {
+        int64_t scale = 1;
+        for (int i = 0;  (i < precision) && (scale <= unitValue);  ++i)
+            scale *= 10;
+
+        if ((scale <= unitValue) && ((unitValue - fraction) <= unitValue / (2 * scale))) {
+            fraction = 0;
+            if (!unitsPerSecond) {
+                ++whole;
+            } else if (++subUnits == unitsPerSecond) {
+                subUnits = 0;
+                ++whole;
+            }
+        }
+    }
+
+    // Print the whole part, with leading zeros to fill the field width if requested.
+
+    char wholeDigits[40];
+    char* digitsEnd;
+
+    if (!unitsPerSecond) {
+        digitsEnd = std::to_chars (wholeDigits, std::end(wholeDigits), whole).ptr;
+    } else if (whole == 0) {
+        digitsEnd = std::to_chars (wholeDigits, std::end(wholeDigits), subUnits).ptr;
+    } else {
+        digitsEnd = std::to_chars (wholeDigits, std::end(wholeDigits), whole).ptr;
+        for (auto place = unitsPerSecond / 10;  place > 0;  place /= 10)
+            *digitsEnd++ = static_cast<char>('0' + subUnits / place % 10);
+    }
+
+    auto numDigits    = static_cast<int>(digitsEnd - wholeDigits);
+    auto fieldLength  = numDigits + (precision ? precision + 1 : 0);
+    auto numZeros     = std::max (0, delta.leadingZeros - fieldLength);
+    auto wholeLength  = numZeros + numDigits;
+
+    output.reserve (output.length() + wholeLength + wholeLength / 3 + precision + 1);
+
+    for (int i = 0;  i < wholeLength;  ++i) {
+        if (delta.thousandsChar && i > 0 && (wholeLength - i) % 3 == 0)
+            output += delta.thousandsChar;
+        output += (i < numZeros) ? L'0' : static_cast<wchar_t>(wholeDigits[i - numZeros]);
+    }
+
+    if (precision == 0)
+        return;
+
+    // Print the fractional digits by long division, then round the last digit. Any carry stays
+    // within the fractional digits, since carries into the whole part were handled above.
+
+    output += delta.decimalChar ? delta.decimalChar : L'.';
+
+    for (int i = 0;  i < precision;  ++i) {
+        fraction *= 10;
+        output += static_cast<wchar_t>(L'0' + fraction / unitValue);
+        fraction %= unitValue;
+    }
+
+    if (2 * fraction >= unitValue) {
+        auto digitIndex = output.length() - 1;
+        while (output[digitIndex] == L'9')
+            output[digitIndex--] = L'0';
+        ++output[digitIndex];
+    }
+}
+
+
+//======================================================================================================================
+// Results Printing
+//======================================================================================================================
+
+class LocaleNames {
+    // The day names, month names and AM/PM designations of a locale, extracted once with wcsftime()
+    // so that name codes are a table lookup instead of a C runtime call per field.
+
+  public:
+    string  localeName;         // Name of the locale (LC_TIME category) the tables were loaded for
+    bool    loaded { false };
+
+    void load (const char* locale) {
+        // Loads the name tables from the current locale, which has the given name.
+
+        wchar_t buffer [256];
+        tm      probe {};
+
+        probe.tm_year = 101;    // Any valid date; wcsftime() only consults the field for each name.
+        probe.tm_mday = 1;
+
+        auto get = [&](const wchar_t* code) {
+            return wstring (buffer, wcsftime (buffer, std::size(buffer), code, &probe));
+        };
+
+        for (int day = 0;  day < 7;  ++day) {
+            probe.tm_wday = day;
+            names[int(NameType::WeekdayShort)][day] = get (L"%a");
+            names[int(NameType::Weekday)][day]      = get (L"%A");
+        }
+
+        for (int month = 0;  month < 12;  ++month) {
+            probe.tm_mon = month;
+            names[int(NameType::MonthShort)][month] = get (L"%b");
+            names[int(NameType::Month)][month]      = get (L"%B");
+        }
+
+        for (int half = 0;  half < 2;  ++half) {
+            probe.tm_hour = 12 * half;
+            names[int(NameType::AmPm)][half] = get (L"%p");
+        }
+
+        localeName = locale;
+        loaded = true;
+    }
+
+    const wstring& name (NameType type, const tm& time) const {
+        switch (type) {
+            case NameType::WeekdayShort:
+            case NameType::Weekday:     return names[int(type)][time.tm_wday];
+            case NameType::MonthShort:
+            case NameType::Month:       return names[int(type)][time.tm_mon];
+            default:                    return names[int(type)][(time.tm_hour < 12) ? 0 : 1];
+        }
+    }
+
+  private:
+    wstring names [5][12];      // Names indexed by name type, then by day, month or half day
+};
+
+//__________________________________________________________________________________________________
+
+const LocaleNames& currentLocaleNames () {
+    // Returns the name tables for the current locale, loading them on first use or when the locale
+    // changes. Tables are kept per thread, so no locking is needed.
+
+    static thread_local LocaleNames names;
+
+    const char* locale = setlocale (LC_TIME, nullptr);
+    if (!locale)
+        locale = "C";
+
+    if (!names.loaded || names.localeName != locale)
+        names.load (locale);
+
+    return names;
+}
+
+//__________________________________________________________________________________________________
+
+void printResults (
+    wstring&          output,             // Output destination
+    const FormatPlan& plan,               // The compiled format plan
+    const tm&         timeValue,          // The primary time value to use
+    int32_t           nanoseconds,        // Fractional seconds of the time value
+    const ZoneInfo&   zone,               // Time zone state for the time value
+    Time              deltaTime,          // Time difference when comparing two times
+    vector<size_t>*   fractionOffsets = nullptr)  // Optional output offsets of fractional seconds
+{
+    // This procedure walks the compiled format plan, appending literal runs and expanded codes to
+    // the output. If fractionOffsets is given, the output offset of each fractional seconds field is
+    // appended to it, in plan order.
+
+    const auto buffSize = 1024;
+    wchar_t    outputBuffer [buffSize];     // Intermediate Output Buffer
+
+    const LocaleNames* names = nullptr;     // Locale name tables, fetched on first use
+
+    // Decompose the time difference once, for all delta time codes in the format.
+    DeltaTime decomposedDelta;
+    if (!plan.deltas.empty())
+        decomposedDelta = decomposeDelta (deltaTime);
+
+    for (const auto& op : plan.ops) {
+        switch (op.type) {
+            case FormatOpType::Literal:
+                output.append (plan.text.c_str() + op.index, op.length);
+                break;
+
+            case FormatOpType::TimeCode: {
+                auto length = wcsftime (outputBuffer, std::size(outputBuffer), plan.text.c_str() + op.index, &timeValue);
+                output.append (outputBuffer, length);
+                break;
+            }
+
+            case FormatOpType::ZoneOffset: {
+                // ISO 8601 offset of the form [+|-]HHMM.
+                auto minutes = std::abs (zone.offset) / secondsPerMinute;
+                wchar_t offset[] = {
+                    (zone.offset < 0) ? L'-' : L'+',
+                    static_cast<wchar_t>(L'0' + minutes / 600),
+                    static_cast<wchar_t>(L'0' + minutes / 60 % 10),
+                    static_cast<wchar_t>(L'0' + minutes % 60 / 10),
+                    static_cast<wchar_t>(L'0' + minutes % 10)
+                };
+                output.append (offset, std::size(offset));
+                break;
+            }
+
+            case FormatOpType::ZoneName:
+                output += zone.abbreviation;
+                break;
+
+            case FormatOpType::Name: {
+                if (!names)
+                    names = &currentLocaleNames();
+
+                auto& name = names->name (static_cast<NameType>(op.index), timeValue);
+                output.append (name, 0, op.length);
+                break;
+            }
+
+            case FormatOpType::Fraction: {
+                // Leading digits of the nanoseconds, truncated.
+                if (fractionOffsets)
+                    fractionOffsets->push_back (output.length());
+
+                wchar_t digits[9];
+                auto    value = nanoseconds;
+                for (int i = 8;  i >= 0;  --i, value /= 10)
+                    digits[i] = static_cast<wchar_t>(L'0' + value % 10);
+                output.append (digits, op.length);
+                break;
+            }
+
+            case FormatOpType::Delta:
+                printDelta (output, plan.deltas[op.index], decomposedDelta);
+                break;
+        }
+    }
+}
+
+
+//__________________________________________________________________________________________________
+
+class CachedTimestamp {
+    // The rendered output of a format for one second of time, in one time zone. Only fractional
+    // seconds fields vary within a second, so this text is reused for every time in the same
+    // second, with the fractional digits patched in at the recorded offsets.
+
+  public:
+    std::shared_ptr<const FormatPlan> plan;     // Format plan, held so that its address stays unique
+    uint64_t        zoneId  { 0 };              // Zone setting the text was rendered in
+    int64_t         seconds { 0 };              // Second the text was rendered for
+    wstring         text;                       // Rendered output
+    vector<size_t>  fractionOffsets;            // Offsets of the fractional seconds fields in text
+};
+
+static const int cachedTimestampCount = 4;      // Cached timestamps kept per thread
+
+//__________________________________________________________________________________________________
+
+void printCachedResults (
+    wstring&                                 output,    // Output destination
+    const std::shared_ptr<const FormatPlan>& plan,      // The compiled format plan
+    const TimeContext&                       context,   // Time zone for local times
+    Time                                     time)      // The time value to print
+{
+    // Prints the time value as printResults() does, using a per-thread cache of rendered output.
+    // A time in the same second as a cached entry for the same plan and zone costs only a copy and
+    // patching the fractional seconds digits. The cache is per thread, so no locking is needed.
+
+    static thread_local CachedTimestamp cache [cachedTimestampCount];
+    static thread_local int             nextEntry = 0;
+
+    CachedTimestamp* entry = nullptr;
+
+    for (auto& candidate : cache) {
+        if (candidate.plan == plan && candidate.zoneId == context.zoneId) {
+            entry = &candidate;
+            break;
+        }
+    }
+
+    if (!entry) {
+        entry = &cache[nextEntry];
+        nextEntry = (nextEntry + 1) % cachedTimestampCount;
+        entry->plan = plan;
+        entry->zoneId = context.zoneId;
+        entry->text.clear();
+        entry->seconds = time.seconds + 1;     // Force a render below
+    }
+
+    if (entry->seconds != time.seconds) {
+        tm       timeValue;
+        int32_t  nanoseconds;
+        ZoneInfo zone;
+        Time     deltaTime;
+
+        entry->seconds = time.seconds;
+        entry->text.clear();
+        entry->fractionOffsets.clear();
+
+        calcResult (context, time, Time(), false, timeValue, nanoseconds, zone, deltaTime);
+        printResults (entry->text, *plan, timeValue, nanoseconds, zone, deltaTime, &entry->fractionOffsets);
+        output += entry->text;
+        return;
+    }
+
+    auto start = output.length();
+    output += entry->text;
+
+    if (entry->fractionOffsets.empty())
+        return;
+
+    wchar_t digits[9];
+    auto    value = time.nanoseconds;
+    for (int i = 8;  i >= 0;  --i, value /= 10)
+        digits[i] = static_cast<wchar_t>(L'0' + value % 10);
+
+    // Fraction fields appear in plan order, matching the recorded offsets.
+    auto offset = entry->fractionOffsets.begin();
+    for (const auto& op : plan->ops) {
+        if (op.type == FormatOpType::Fraction) {
+            std::copy (digits, digits + op.length, &output[start + *offset]);
+            ++offset;
+        }
+    }
+}
+
+
+//======================================================================================================================
+// ISO Batch Formatting
+//======================================================================================================================
+
+// Bulk times are formatted as fixed-width `YYYY-MM-DDTHH:MM:SS+hhmm` records. Each record is six
+// four-character quads, so a block of records is computed with one record per vector lane, one
+// quad at a time, and then transposed in registers into record order. Dates use the Euclidean
+// affine algorithm of Neri and Schneider, which needs only multiplies and shifts. Epoch seconds
+// are split into local days and seconds of the day per time, since 64-bit division has no vector
+// form.
+
+static const int64_t isoBatchMinSeconds = daysFromCivil (0, 1, 1) * secondsPerDay;     // First four-digit year
+static const int64_t isoBatchMaxSeconds = daysFromCivil (10000, 1, 1) * secondsPerDay - 1;
+
+enum class SimdLevel {
+    // Vector instruction sets available for batch formatting, in increasing order
+
+    Scalar,
+    SSE41,
+    AVX2,
+};
+
+//__________________________________________________________________________________________________
+
+SimdLevel simdLevel () {
+    // Returns the best vector instruction set supported by both the processor and the operating
+    // system. This is checked once per process.
+
+    static const auto level = []{
+        auto level = SimdLevel::Scalar;
+
+#if defined(_M_X64) || defined(_M_IX86)
+        int info[4];
+        __cpuid (info, 0);
+        auto maxLeaf = info[0];
+
+        __cpuid (info, 1);
+        auto sse41   = (info[2] & (1 << 19)) != 0;
+        auto osxsave = (info[2] & (1 << 27)) != 0;
+        auto avx     = (info[2] & (1 << 28)) != 0;
+
+        if (sse41)
+            level = SimdLevel::SSE41;
+
+        // AVX2 also needs the operating system to save the upper halves of the vector registers.
+        if (sse41 && avx && osxsave && ((_xgetbv(0) & 6) == 6) && (maxLeaf >= 7)) {
+            __cpuidex (info, 7, 0);
+            if (info[1] & (1 << 5))
+                level = SimdLevel::AVX2;
+        }
+#endif
+
+        return level;
+    }();
+
+    return level;
+}
+
+//__________________________________________________________________________________________________
+
+bool splitLocalTime (int64_t time, int utcOffset, int32_t& days, int32_t& daySeconds) {
+    // Splits the time at the given offset from UTC into local days since 1970-01-01 and seconds of
+    // the day. Returns false if the local date is outside the four-digit years 0000 through 9999.
+
+    if ((time < isoBatchMinSeconds - secondsPerDay) || (isoBatchMaxSeconds + secondsPerDay < time))
+        return false;
+
+    auto local = time + utcOffset;
+    if ((local < isoBatchMinSeconds) || (isoBatchMaxSeconds < local))
+        return false;
+
+    auto localDays = floorDiv (local, secondsPerDay);
+
+    days       = static_cast<int32_t>(localDays);
+    daySeconds = static_cast<int32_t>(local - localDays * secondsPerDay);
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+void formatISORecord (int32_t days, int32_t daySeconds, const char (&zone)[5], char* output) {
+    // Writes a single fixed-width record for the given local day and second of the day. This is
+    // the scalar form of formatISOLanes().
+
+    auto date  = civilFromDays (days);
+    auto year  = static_cast<int>(date.year);
+    auto digit = [](int value) { return static_cast<char>('0' + value % 10); };
+
+    const char record[isoBatchLength] {
+        digit(year / 1000), digit(year / 100), digit(year / 10), digit(year),
+        '-', digit(date.month / 10), digit(date.month),
+        '-', digit(date.day / 10), digit(date.day),
+        'T', digit(daySeconds / 36000), digit(daySeconds / 3600),
+        ':', digit(daySeconds / 600 % 6), digit(daySeconds / 60),
+        ':', digit(daySeconds % 60 / 10), digit(daySeconds),
+        zone[0], zone[1], zone[2], zone[3], zone[4]
+    };
+
+    memcpy (output, record, isoBatchLength);
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+
+//__________________________________________________________________________________________________
+
+void storeISORecords (
+    char* output, __m128i record0, __m128i record1, __m128i record2, __m128i record3, __m128i tail01,
+    __m128i tail23)
+{
+    // Stores four consecutive records, given the first sixteen characters of each record, and the
+    // last eight characters of records 0 and 1, and of records 2 and 3.
+
+    _mm_storeu_si128 (reinterpret_cast<__m128i*>(output +  0), record0);
+    _mm_storel_epi64 (reinterpret_cast<__m128i*>(output + 16), tail01);
+    _mm_storeu_si128 (reinterpret_cast<__m128i*>(output + 24), record1);
+    _mm_storel_epi64 (reinterpret_cast<__m128i*>(output + 40), _mm_srli_si128 (tail01, 8));
+    _mm_storeu_si128 (reinterpret_cast<__m128i*>(output + 48), record2);
+    _mm_storel_epi64 (reinterpret_cast<__m128i*>(output + 64), tail23);
+    _mm_storeu_si128 (reinterpret_cast<__m128i*>(output + 72), record3);
+    _mm_storel_epi64 (reinterpret_cast<__m128i*>(output + 88), _mm_srli_si128 (tail23, 8));
+}
+
+//__________________________________________________________________________________________________
+
+class SSE41Lanes {
+    // Operations on four 32-bit vector lanes, using SSE4.1.
+
+  public:
+    using Vector = __m128i;
+    static const int count = 4;
+
+    static Vector set (uint32_t x)              { return _mm_set1_epi32 (static_cast<int>(x)); }
+    static Vector load (const int32_t* p)       { return _mm_loadu_si128 (reinterpret_cast<const __m128i*>(p)); }
+    static Vector add (Vector a, Vector b)      { return _mm_add_epi32 (a, b); }
+    static Vector sub (Vector a, Vector b)      { return _mm_sub_epi32 (a, b); }
+    static Vector mul (Vector a, Vector b)      { return _mm_mullo_epi32 (a, b); }
+    static Vector bitAnd (Vector a, Vector b)   { return _mm_and_si128 (a, b); }
+    static Vector bitOr (Vector a, Vector b)    { return _mm_or_si128 (a, b); }
+    static Vector greater (Vector a, Vector b)  { return _mm_cmpgt_epi32 (a, b); }
+    static Vector shiftLeft (Vector a, int n)   { return _mm_slli_epi32 (a, n); }
+    static Vector shiftRight (Vector a, int n)  { return _mm_srli_epi32 (a, n); }
+
+    static Vector mulHigh (Vector a, Vector b) {
+        // Returns the high halves of the unsigned 64-bit products.
+        auto even = _mm_srli_epi64 (_mm_mul_epu32 (a, b), 32);
+        auto odd  = _mm_mul_epu32 (_mm_srli_epi64 (a, 32), b);
+        return _mm_blend_epi16 (even, odd, 0xCC);
+    }
+
+    static void store (char* output, const Vector (&quads)[6]) {
+        // Transposes the quads of four records, one record per lane, into record order.
+
+        auto q01lo = _mm_unpacklo_epi32 (quads[0], quads[1]);
+        auto q01hi = _mm_unpackhi_epi32 (quads[0], quads[1]);
+        auto q23lo = _mm_unpacklo_epi32 (quads[2], quads[3]);
+        auto q23hi = _mm_unpackhi_epi32 (quads[2], quads[3]);
+
+        storeISORecords (output,
+            _mm_unpacklo_epi64 (q01lo, q23lo), _mm_unpackhi_epi64 (q01lo, q23lo),
+            _mm_unpacklo_epi64 (q01hi, q23hi), _mm_unpackhi_epi64 (q01hi, q23hi),
+            _mm_unpacklo_epi32 (quads[4], quads[5]), _mm_unpackhi_epi32 (quads[4], quads[5]));
+    }
+};
+
+//__________________________________________________________________________________________________
+
+class AVX2Lanes {
+    // Operations on eight 32-bit vector lanes, using AVX2.
+
+  public:
+    using Vector = __m256i;
+    static const int count = 8;
+
+    static Vector set (uint32_t x)              { return _mm256_set1_epi32 (static_cast<int>(x)); }
+    static Vector load (const int32_t* p)       { return _mm256_loadu_si256 (reinterpret_cast<const __m256i*>(p)); }
+    static Vector add (Vector a, Vector b)      { return _mm256_add_epi32 (a, b); }
+    static Vector sub (Vector a, Vector b)      { return _mm256_sub_epi32 (a, b); }
+    static Vector mul (Vector a, Vector b)      { return _mm256_mullo_epi32 (a, b); }
+    static Vector bitAnd (Vector a, Vector b)   { return _mm256_and_si256 (a, b); }
+    static Vector bitOr (Vector a, Vector b)    { return _mm256_or_si256 (a, b); }
+    static Vector greater (Vector a, Vector b)  { return _mm256_cmpgt_epi32 (a, b); }
+    static Vector shiftLeft (Vector a, int n)   { return _mm256_slli_epi32 (a, n); }
+    static Vector shiftRight (Vector a, int n)  { return _mm256_srli_epi32 (a, n); }
+
+    static Vector mulHigh (Vector a, Vector b) {
+        // Returns the high halves of the unsigned 64-bit products.
+        auto even = _mm256_srli_epi64 (_mm256_mul_epu32 (a, b), 32);
+        auto odd  = _mm256_mul_epu32 (_mm256_srli_epi64 (a, 32), b);
+        return _mm256_blend_epi32 (even, odd, 0xAA);
+    }
+
+    static void store (char* output, const Vector (&quads)[6]) {
+        // Transposes the quads of eight records, one record per lane, into record order. AVX2
+        // unpacks work within each 128-bit half, so the low halves hold records 0 through 3, and
+        // the high halves hold records 4 through 7.
+
+        auto q01lo = _mm256_unpacklo_epi32 (quads[0], quads[1]);
+        auto q01hi = _mm256_unpackhi_epi32 (quads[0], quads[1]);
+        auto q23lo = _mm256_unpacklo_epi32 (quads[2], quads[3]);
+        auto q23hi = _mm256_unpackhi_epi32 (quads[2], quads[3]);
+
+        __m256i records[] {
+            _mm256_unpacklo_epi64 (q01lo, q23lo), _mm256_unpackhi_epi64 (q01lo, q23lo),
+            _mm256_unpacklo_epi64 (q01hi, q23hi), _mm256_unpackhi_epi64 (q01hi, q23hi),
+            _mm256_unpacklo_epi32 (quads[4], quads[5]), _mm256_unpackhi_epi32 (quads[4], quads[5])
+        };
+
+        storeISORecords (output,
+            _mm256_castsi256_si128 (records[0]), _mm256_castsi256_si128 (records[1]),
+            _mm256_castsi256_si128 (records[2]), _mm256_castsi256_si128 (records[3]),
+            _mm256_castsi256_si128 (records[4]), _mm256_castsi256_si128 (records[5]));
+
+        storeISORecords (output + 4 * isoBatchLength,
+            _mm256_extracti128_si256 (records[0], 1), _mm256_extracti128_si256 (records[1], 1),
+            _mm256_extracti128_si256 (records[2], 1), _mm256_extracti128_si256 (records[3], 1),
+            _mm256_extracti128_si256 (records[4], 1), _mm256_extracti128_si256 (records[5], 1));
+    }
+};
+
+//__________________________________________________________________________________________________
+
+template <typename Lanes>
+void formatISOLanes (const int32_t* days, const int32_t* daySeconds, const char (&zone)[5], char* output) {
+    // Writes one fixed-width record for each vector lane, from the given local days since
+    // 1970-01-01 and seconds of the day. All digits and punctuation are placed in registers.
+
+    using L = Lanes;
+
+    // Date. Days are counted from 0000-03-01 less one 400-year era, so that all four-digit years
+    // have positive day counts. Each division by a constant is a multiply and shift.
+
+    auto n1    = L::add (L::shiftLeft (L::add (L::load (days), L::set (daysToEpoch + daysPer400Years)), 2), L::set (3));
+    auto c     = L::shiftRight (L::mulHigh (n1, L::set (3853261556u)), 17);     // n1 / 146097: centuries
+    auto nc    = L::shiftRight (L::sub (n1, L::mul (c, L::set (146097))), 2);   // Day of the century
+    auto n2    = L::add (L::shiftLeft (nc, 2), L::set (3));
+    auto z     = L::mulHigh (n2, L::set (2939745));                            // n2 / 1461: year of the century
+    auto ny    = L::sub (nc, L::shiftRight (L::mul (z, L::set (1461)), 2));    // Day of the year, from March 1
+    auto n3    = L::add (L::mul (ny, L::set (2141)), L::set (197913));
+    auto jan   = L::greater (ny, L::set (305));                                // All ones in January and February
+    auto year  = L::sub (L::add (L::mul (c, L::set (100)), z), L::add (L::set (400), jan));
+    auto month = L::sub (L::shiftRight (n3, 16), L::bitAnd (jan, L::set (12)));
+    auto day   = L::add (L::shiftRight (L::mulHigh (L::bitAnd (n3, L::set (0xFFFF)), L::set (4108404028u)), 11), L::set (1));
+
+    // Time of day
+
+    auto seconds = L::load (daySeconds);
+    auto hour    = L::shiftRight (L::mulHigh (seconds, L::set (2443359173u)), 11);   // seconds / 3600
+    auto rest    = L::sub (seconds, L::mul (hour, L::set (3600)));
+    auto minute  = L::shiftRight (L::mul (rest, L::set (17477)), 20);               // rest / 60
+    auto second  = L::sub (rest, L::mul (minute, L::set (60)));
+
+    // Digits. A value from 0 to 99 becomes its tens digit in the low byte and its ones digit in the
+    // next byte. Character zeros and punctuation are then merged in with a constant per quad.
+
+    auto tens      = [](typename L::Vector v) { return L::shiftRight (L::mul (v, L::set (103)), 10); };
+    auto twoDigits = [&](typename L::Vector v) {
+        auto t = tens (v);
+        return L::bitOr (t, L::shiftLeft (L::sub (v, L::mul (t, L::set (10))), 8));
+    };
+
+    auto century   = L::shiftRight (L::mul (year, L::set (5243)), 19);                 // year / 100
+    auto hourTens  = tens (hour);
+    auto hourOnes  = L::sub (hour, L::mul (hourTens, L::set (10)));
+
+    uint32_t zoneQuad;
+    memcpy (&zoneQuad, zone + 1, sizeof zoneQuad);
+
+    const typename L::Vector quads[6] {
+        // YYYY
+        L::bitOr (L::bitOr (twoDigits (century), L::shiftLeft (twoDigits (L::sub (year, L::mul (century, L::set (100)))), 16)),
+                  L::set (0x30303030)),
+        // -MM-
+        L::bitOr (L::shiftLeft (twoDigits (month), 8), L::set (0x2D30302D)),
+        // DDTh
+        L::bitOr (L::bitOr (twoDigits (day), L::shiftLeft (hourTens, 24)), L::set (0x30543030)),
+        // h:MM
+        L::bitOr (L::bitOr (hourOnes, L::shiftLeft (twoDigits (minute), 16)), L::set (0x30303A30)),
+        // :SS+
+        L::bitOr (L::shiftLeft (twoDigits (second), 8), L::set ((uint32_t(uint8_t(zone[0])) << 24) | 0x30303A)),
+        // hhmm
+        L::set (zoneQuad)
+    };
+
+    L::store (output, quads);
+}
+
+#endif
+
+//__________________________________________________________________________________________________
+
+size_t formatISOBatch (const int64_t* times, size_t count, int utcOffset, char* output) {
+    if ((utcOffset <= -secondsPerDay) || (secondsPerDay <= utcOffset))
+        return 0;
+
+    // The zone offset is the same for every record: [+|-]hhmm.
+
+    auto offsetMinutes = std::abs (utcOffset) / secondsPerMinute;
+
+    const char zone[5] {
+        (utcOffset < 0) ? '-' : '+',
+        static_cast<char>('0' + offsetMinutes / 600),
+        static_cast<char>('0' + offsetMinutes / 60 % 10),
+        static_cast<char>('0' + offsetMinutes % 60 / 10),
+        static_cast<char>('0' + offsetMinutes % 10)
+    };
+
+    size_t i = 0;
+
+#if defined(_M_X64) || defined(_M_IX86)
+    // Format full blocks of lanes while all times are in range. Any remaining times, and any block
+    // with a time out of range, are finished one at a time.
+
+    auto level     = simdLevel();
+    auto laneCount = (level == SimdLevel::AVX2) ? AVX2Lanes::count : SSE41Lanes::count;
+
+    int32_t days[AVX2Lanes::count];
+    int32_t daySeconds[AVX2Lanes::count];
+
+    for (;  (level != SimdLevel::Scalar) && (i + laneCount <= count);  i += laneCount) {
+        auto inRange = true;
+        for (int lane = 0;  lane < laneCount;  ++lane)
+            inRange = splitLocalTime (times[i + lane], utcOffset, days[lane], daySeconds[lane]) && inRange;
+
+        if (!inRange)
+            break;
+
+        if (level == SimdLevel::AVX2)
+            formatISOLanes<AVX2Lanes> (days, daySeconds, zone, output + i * isoBatchLength);
+        else
+            formatISOLanes<SSE41Lanes> (days, daySeconds, zone, output + i * isoBatchLength);
+    }
+#endif
+
+    for (;  i < count;  ++i) {
+        int32_t days, daySeconds;
+        if (!splitLocalTime (times[i], utcOffset, days, daySeconds))
+            return i;
+
+        formatISORecord (days, daySeconds, zone, output + i * isoBatchLength);
+    }
+
+    return count;
+}
+
+
+//======================================================================================================================
+// Library Interface
+//======================================================================================================================
+
+size_t copyOutput (const wstring& text, wchar_t* buffer, size_t bufferSize) {
+    // Copies the text to the given buffer in the style of snprintf(), truncating if needed, and
+    // returns the full length of the text.
+
+    if (bufferSize > 0) {
+        auto length = std::min (text.length(), bufferSize - 1);
+        wmemcpy (buffer, text.data(), length);
+        buffer[length] = 0;
+    }
+
+    return text.length();
+}
+
+//__________________________________________________________________________________________________
+
+Format::Format ()
+  : plan(std::make_shared<FormatPlan>())
+{
+}
+
+Format::Format (const wstring& format, wchar_t codeChar)
+  : plan(std::make_shared<FormatPlan>(compileFormat (format, codeChar)))
+{
+}
+
+//__________________________________________________________________________________________________
+
+Context::Context ()
+  : state(std::make_unique<TimeContext>())
+{
+    // The default zone is loaded on first use; see ready().
+    getCurrentTime (*state);
+}
+
+Context::~Context () = default;
+
+Context::Context (Context&&) noexcept = default;
+
+Context& Context::operator= (Context&&) noexcept = default;
+
+//__________________________________________________________________________________________________
+
+bool Context::setTimeZone (const wstring& zone) {
+    // Zone loading leaves the zone unchanged on failure. A zone set here replaces any lazy load of
+    // the default zone.
+
+    if (!zone.empty() && !state->zone.load (zone))
+        return false;
+
+    getCurrentTime (*state);
+
+    if (zone.empty())
+        loadDefaultZone (*state);
+    else
+        markZoneLoaded (*state);
+
+    std::call_once (state->zoneOnce, []{});
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+const TimeContext& Context::ready () const {
+    // Returns the context state, first loading the default zone if no zone has been loaded yet.
+
+    std::call_once (state->zoneOnce, [this]{
+        if (!state->zoneReady)
+            loadDefaultZone (*state);
+    });
+
+    return *state;
+}
+
+//__________________________________________________________________________________________________
+
+void Context::snapshotTime () {
+    getCurrentTime (*state);
+}
+
+Time Context::currentTime () const {
+    return state->currentTime;
+}
+
+//__________________________________________________________________________________________________
+
+template <typename CharT>
+bool parseTime (const TimeContext& context, const CharT* begin, const CharT* end, Time& result, size_t* errorIndex) {
+    // Common implementation of the narrow and wide character Context::parse() functions.
+
+    size_t index;
+
+    if (!getExplicitDateTime (context, result, begin, end, index)) {
+        if (errorIndex) *errorIndex = index;
+        return false;
+    }
+
+    return true;
+}
+
+bool Context::parse (const wchar_t* begin, const wchar_t* end, Time& result, size_t* errorIndex) const {
+    return parseTime (ready(), begin, end, result, errorIndex);
+}
+
+bool Context::parse (const char* begin, const char* end, Time& result, size_t* errorIndex) const {
+    return parseTime (ready(), begin, end, result, errorIndex);
+}
+
+//__________________________________________________________________________________________________
+
+void Context::format (wstring& output, const Format& format, Time time) const {
+    tm       timeValue;
+    int32_t  nanoseconds;
+    ZoneInfo zone;
+    Time     deltaTime;
+
+    calcResult (ready(), time, Time(), false, timeValue, nanoseconds, zone, deltaTime);
+    printResults (output, *format.plan, timeValue, nanoseconds, zone, deltaTime);
+}
+
+void Context::formatDelta (wstring& output, const Format& format, Time time1, Time time2) const {
+    tm       timeValue;
+    int32_t  nanoseconds;
+    ZoneInfo zone;
+    Time     deltaTime;
+
+    calcResult (ready(), time1, time2, true, timeValue, nanoseconds, zone, deltaTime);
+    printResults (output, *format.plan, timeValue, nanoseconds, zone, deltaTime);
+}
+
+//__________________________________________________________________________________________________
+
+size_t Context::format (wchar_t* buffer, size_t bufferSize, const Format& format, Time time) const {
+    // Formats to a reusable per-thread string, then copies to the caller's buffer.
+    static thread_local wstring text;
+
+    text.clear();
+    this->format (text, format, time);
+    return copyOutput (text, buffer, bufferSize);
+}
+
+size_t Context::formatDelta (
+    wchar_t* buffer, size_t bufferSize, const Format& format, Time time1, Time time2) const
+{
+    static thread_local wstring text;
+
+    text.clear();
+    this->formatDelta (text, format, time1, time2);
+    return copyOutput (text, buffer, bufferSize);
+}
+
+//__________________________________________________________________________________________________
+
+TimeFields fieldsFromTm (const tm& time, int32_t nanoseconds, const ZoneInfo& zone) {
+    TimeFields fields;
+
+    fields.year       = time.tm_year + 1900;
+    fields.month      = time.tm_mon + 1;
+    fields.day        = time.tm_mday;
+    fields.hour       = time.tm_hour;
+    fields.minute     = time.tm_min;
+    fields.second     = time.tm_sec;
+    fields.nanosecond = nanoseconds;
+    fields.weekday    = time.tm_wday;
+    fields.yearDay    = time.tm_yday;
+    fields.utcOffset  = zone.offset;
+    fields.zoneName   = zone.abbreviation;
+
+    return fields;
+}
+
+TimeFields utcFields (Time time) {
+    tm timeValue;
+    tmFromEpoch (time.seconds, timeValue);
+    return fieldsFromTm (timeValue, time.nanoseconds, ZoneInfo());
+}
+
+TimeFields Context::fields (Time time) const {
+    tm       timeValue;
+    ZoneInfo zone;
+
+    ready().zone.localTime (time.seconds, timeValue, zone);
+    return fieldsFromTm (timeValue, time.nanoseconds, zone);
+}
+
+//__________________________________________________________________________________________________
+
+void Context::formatCached (wstring& output, const Format& format, Time time) const {
+    printCachedResults (output, format.plan, ready(), time);
+}
+
+size_t Context::formatCached (wchar_t* buffer, size_t bufferSize, const Format& format, Time time) const {
+    static thread_local wstring text;
+
+    text.clear();
+    printCachedResults (text, format.plan, ready(), time);
+    return copyOutput (text, buffer, bufferSize);
+}
+
+}   // namespace timeprint
+
+
+//======================================================================================================================
+// C Interface
+//======================================================================================================================
+
+// The C interface wraps the C++ interface. No exceptions may cross the C boundary, so allocation
+// failures are reported as null results.
+
+struct timeprint_context {
+    timeprint::Context context;
+};
+
+struct timeprint_format {
+    timeprint::Format format;
+};
+
+static timeprint::Time fromCTime (timeprint_time time) {
+    return timeprint::Time (time.seconds, time.nanoseconds);
+}
+
+static timeprint_time toCTime (timeprint::Time time) {
+    return timeprint_time { time.seconds, time.nanoseconds };
+}
+
+//__________________________________________________________________________________________________
+
+timeprint_context* timeprint_context_create (const wchar_t* zone) {
+    try {
+        auto result = new timeprint_context;
+        if (zone && *zone && !result->context.setTimeZone (zone)) {
+            delete result;
+            return nullptr;
+        }
+        return result;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void timeprint_context_destroy (timeprint_context* context) {
+    delete context;
+}
+
+int64_t timeprint_current_time (const timeprint_context* context) {
+    return context->context.currentTime().seconds;
+}
+
+timeprint_time timeprint_current_time_ns (const timeprint_context* context) {
+    return toCTime (context->context.currentTime());
+}
+
+//__________________________________________________________________________________________________
+
+timeprint_format* timeprint_format_create (const wchar_t* format, wchar_t codeChar) {
+    try {
+        return new timeprint_format { timeprint::Format (format ? format : L"", codeChar) };
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void timeprint_format_destroy (timeprint_format* format) {
+    delete format;
+}
+
+//__________________________________________________________________________________________________
+
+int timeprint_parse (
+    const timeprint_context* context, const char* text, size_t length, int64_t* result, size_t* errorIndex)
+{
+    timeprint::Time time;
+    if (!context->context.parse (text, text + length, time, errorIndex))
+        return 0;
+
+    *result = time.seconds;
+    return 1;
+}
+
+int timeprint_parse_wide (
+    const timeprint_context* context, const wchar_t* text, size_t length, int64_t* result, size_t* errorIndex)
+{
+    timeprint::Time time;
+    if (!context->context.parse (text, text + length, time, errorIndex))
+        return 0;
+
+    *result = time.seconds;
+    return 1;
+}
+
+int timeprint_parse_ns (
+    const timeprint_context* context, const char* text, size_t length, timeprint_time* result, size_t* errorIndex)
+{
+    timeprint::Time time;
+    if (!context->context.parse (text, text + length, time, errorIndex))
+        return 0;
+
+    *result = toCTime (time);
+    return 1;
+}
+
+int timeprint_parse_wide_ns (
+    const timeprint_context* context, const wchar_t* text, size_t length, timeprint_time* result,
+    size_t* errorIndex)
+{
+    timeprint::Time time;
+    if (!context->context.parse (text, text + length, time, errorIndex))
+        return 0;
+
+    *result = toCTime (time);
+    return 1;
+}
+
+//__________________________________________________________________________________________________
+
+size_t timeprint_format_time (
+    const timeprint_context* context, const timeprint_format* format, int64_t time,
+    wchar_t* buffer, size_t bufferSize)
+{
+    try {
+        return context->context.format (buffer, bufferSize, format->format, time);
+    } catch (...) {
+        return timeprint::copyOutput (L"", buffer, bufferSize);
+    }
+}
+
+size_t timeprint_format_delta (
+    const timeprint_context* context, const timeprint_format* format, int64_t time1, int64_t time2,
+    wchar_t* buffer, size_t bufferSize)
+{
+    try {
+        return context->context.formatDelta (buffer, bufferSize, format->format, time1, time2);
+    } catch (...) {
+        return timeprint::copyOutput (L"", buffer, bufferSize);
+    }
+}
+
+size_t timeprint_format_time_ns (
+    const timeprint_context* context, const timeprint_format* format, timeprint_time time,
+    wchar_t* buffer, size_t bufferSize)
+{
+    try {
+        return context->context.format (buffer, bufferSize, format->format, fromCTime (time));
+    } catch (...) {
+        return timeprint::copyOutput (L"", buffer, bufferSize);
+    }
+}
+
+size_t timeprint_format_delta_ns (
+    const timeprint_context* context, const timeprint_format* format, timeprint_time time1,
+    timeprint_time time2, wchar_t* buffer, size_t bufferSize)
+{
+    try {
+        return context->context.formatDelta (buffer, bufferSize, format->format, fromCTime (time1), fromCTime (time2));
+    } catch (...) {
+        return timeprint::copyOutput (L"", buffer, bufferSize);
+    }
+}
+
+size_t timeprint_format_time_cached (
+    const timeprint_context* context, const timeprint_format* format, timeprint_time time,
+    wchar_t* buffer, size_t bufferSize)
+{
+    try {
+        return context->context.formatCached (buffer, bufferSize, format->format, fromCTime (time));
+    } catch (...) {
+        return timeprint::copyOutput (L"", buffer, bufferSize);
+    }
+}
+
+size_t timeprint_format_iso_batch (const int64_t* times, size_t count, int32_t utcOffset, char* output) {
+    return timeprint::formatISOBatch (times, count, utcOffset, output);
+}
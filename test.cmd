@@ -172,6 +172,9 @@ goto :failUnaccepted
     call :errTest --modification file2 --now --time 12:00
     call :errTest -z
     call :errTest --timezone
+    call :errTest --client someBogusSocket
+    call :errTest --newer 2000-01-01
+    call :errTest --threads -1
 
     call :test A b c d e Hello world f g h i j
     call :test "A b c d e Hello world f g h i j"
@@ -196,8 +199,14 @@ goto :failUnaccepted
     call :test --timezone UTC --time 2000-01-02T03:04:05+67
     call :test --timezone UTC --time 2000-01-02T03:04:05-67:89
     call :test --timezone UTC --time 2000-01-02T03:04:05-6789
+    call :test --timezone UTC --time 1969-07-20T20:17:40Z "$F $T $a $j $U $W"
+    call :test --timezone UTC --time 1600-02-29T12:00:00Z "$F $T $a $j $U $W"
+    call :test --timezone UTC --time 2024-03-05T06:07:08.123456789Z "$T.$N $3N $6N $1N $#N $10N $i"
     call :test --timezone UTC --time 2000-01-01T12:00Z "$1a $2a $3a $4a $5a $6a $7a $8a $9a $20a"
     call :test --timezone PST+08 --time 2000-01-01T00:00:00Z "$#c $z $Z"
+    call :test --timezone "CET-1CEST,M3.5.0,M10.5.0/3" --time 2000-07-01T12:00:00Z "$F $T $z $Z"
+    call :test --timezone PST8PDT --time 2006-04-02T09:59:59Z "$F $T $z $Z"
+    call :test --timezone PST8PDT --time 2006-04-02T10:00:00Z "$F $T $z $Z"
 
     call :test --time 2000-01-01T00:00:00Z --time 2000-01-02T00:00:00Z "$_S"
     call :test --time 2000-01-01T00:00:00Z --time 2000-01-02T03:04:05Z "$_Dd $_dH:$_hM:$_mS"
@@ -208,6 +217,10 @@ goto :failUnaccepted
     call :test --time 2000-01-01T00:00:00Z --time 2002-05-07T09:07:53Z "$_M.4"
     call :test --time 2000-01-01T00:00:00Z --time 2002-05-07T09:07:53Z "$_'|_M.4"
     call :test --time 2000-01-01T00:00:00Z --time 2002-05-07T09:07:53Z "$_'0_M.4"
+    call :test --time 2000-01-01T00:00:00Z --time 2000-01-01T00:01:03Z "$_M.1 $_M.2 $_S $_'|_y0S"
+    call :test --time 2000-01-01T00:00:00Z --time 2000-01-01T23:59:59Z "$_D.4 $_d0H.2 $_D.20"
+    call :test --time "2024-03-05T06:07:08,5Z" --time 2024-03-05T06:07:09.25Z "$_S.3 $_L $_U $_N $_s0L $_L. $_S."
+    call :test --time 2000-01-01T00:00:00Z --time 2400-01-01T00:00:00.000000001Z "$_',.N"
 
     call :test --now --creation timeprint.cpp "$_ (bogus delta time value)"
     call :test --now --creation timeprint.cpp "$_y (bogus delta time value)"
@@ -221,6 +234,27 @@ goto :failUnaccepted
     call :test --now --creation timeprint.cpp "$_xm (bogus delta time modulo unit type)"
     call :test --now --creation timeprint.cpp "$_'yM.0 (spurious delta time lead character)"
 
+    call :testBatch 2000-01-02T03:04:05Z --timezone UTC --batch "$F $T"
+    call :testBatch 2000-01-02T03:04:05Z --stdin --time 2000-01-01T00:00:00Z
+    call :testBatch bogus --batch
+    call :testBatch "at 2000-01-02T03:04:05Z, pid 12 @946782245." --timezone UTC --rewrite "$F $T"
+    call :testBatch "2000-01-01T00:00:00Z 2000-01-01T00:01:30Z" --stats "$_S"
+    call :test --input tests\stats-pairs.txt --stats --threads 1 "$_S"
+    call :test --input tests\stats-pairs.txt --stats --threads 2 "$_S"
+
+    call :test --tree tests\tree --threads 1 "(time omitted)"
+    call :test --tree tests\tree --threads 1 --older 9999-01-01 "(time omitted)"
+    call :test --tree . --newer 9999-01-01 "$F (no files this new)"
+
+    call :testJobs "--codeChar $ --time 2000-01-02T03:04:05Z --timezone UTC $F $T"
+    call :testJobs "--time 2000-01-01T00:00:00Z --time 2000-01-02T03:04:05Z"
+
+    call :testServer --time 2000-01-02T03:04:05Z --timezone UTC "$F $T"
+
+    echo.--------------------------------------------------------------------------------
+    echo Static formats [timeprint_bench --check]
+    for %%b in (%timePrint%) do "%%~dpbtimeprint_bench.exe" --check
+
     echo.--------------------------------------------------------------------------------
     exit /b 0
 
@@ -245,6 +279,45 @@ goto :failUnaccepted
     goto :eof
 
 
+:testBatch
+    echo.--------------------------------------------------------------------------------
+    echo Input "%~1" [--codeChar $ %2 %3 %4 %5 %6 %7 %8 %9]
+    echo %~1| %timePrint% --codeChar $ %2 %3 %4 %5 %6 %7 %8 %9
+    set /a testNum = testNum + 1
+    goto :eof
+
+
+:testJobs
+    echo.--------------------------------------------------------------------------------
+    echo Jobs "%~1"
+    echo %~1| %timePrint% --jobs -
+    set /a testNum = testNum + 1
+    goto :eof
+
+
+:testServer
+    :: Starts a server in the background, then checks that a client request through it gives the
+    :: same output as a direct run. The server is started through PowerShell to learn its process
+    :: ID, so that only this server is stopped afterwards.
+    echo.--------------------------------------------------------------------------------
+    echo Server [--codeChar $ %*]
+    for %%b in (%timePrint%) do set serverExe=%%~fb
+    set serverPid=
+    for /f %%p in ('powershell -NoProfile -Command "(Start-Process -PassThru -WindowStyle Hidden -FilePath '%serverExe%' -ArgumentList '--serve','%testOut%\timeprint-test.sock').Id"') do set serverPid=%%p
+    ping -n 2 127.0.0.1 >nul
+    %timePrint% --codeChar $ %* > %testOut%\test-output-direct.txt
+    %timePrint% --client %testOut%\timeprint-test.sock --codeChar $ %* > %testOut%\test-output-client.txt
+    if defined serverPid taskkill /f /pid %serverPid% >nul 2>&1
+    fc >nul %testOut%\test-output-direct.txt %testOut%\test-output-client.txt
+    if %ERRORLEVEL% equ 0 (
+        echo Test passed.
+    ) else (
+        echo Test failed.
+    )
+    set /a testNum = testNum + 1
+    goto :eof
+
+
 :testCapture
     %timePrint% %2 %3 %4 %5 %6 %7 %8 %9 > %testOut%\test-output-%1.txt
     goto :eof
@@ -3,25 +3,49 @@ This program prints the current date and time to the standard output stream.
 It takes an optional format string to control the output.
 *******************************************************************************/
 
+#include "timeprint.h"
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <ctype.h>
-#include <sys/stat.h>
-
+#include <fcntl.h>
+#include <math.h>
+#include <io.h>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+    #include <emmintrin.h>
+    #include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdarg>
-#include <iostream>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <string>
-#include <sstream>
-#include <iomanip>
+#include <thread>
 #include <vector>
 
-using std::time_t;
-using std::tm;
+using std::string;
 using std::vector;
-using std::wcout;
 using std::wstring;
 
+using timeprint::Context;
+using timeprint::Format;
+using timeprint::Time;
+
 static auto version = L"timeprint 3.0.0-alpha.21 | 2023-11-21 | https://github.com/hollasch/timeprint";
 
 enum class HelpType {
@@ -43,13 +67,26 @@ enum class OptionType {
 
     None,
     AccessTime,
+    Batch,
+    Client,
     CodeChar,
     CreationTime,
+    Flush,
     Help,
+    Input,
+    Jobs,
     ModificationTime,
+    Newer,
     Now,
+    Older,
+    Rewrite,
+    Serve,
+    Stats,
+    Threads,
     Time,
     TimeZone,
+    Tree,
+    TreeTime,
     Version,
 };
 
@@ -64,6 +101,14 @@ enum class TimeType {
     Modification  // Modification time of the named file
 };
 
+enum class FlushPolicy {
+    // When buffered output is written to the output stream
+
+    Line,   // After each complete output line
+    Size,   // Whenever the buffered output reaches the flush size
+    Exit,   // Only at exit
+};
+
 class TimeSpec {
   public:
     TimeType type { TimeType::None };   // Type of time
@@ -89,28 +134,27 @@ class Parameters {
     wstring  zone;                         // Time zone string
     wstring  format;                       // Output format string
     bool     isDelta  { false };           // Time calculation is a difference between two times
+    bool     isBatch  { false };           // Format time values read from the standard input stream
+    bool     isRewrite { false };          // Rewrite timestamps embedded in batch input text
+    bool     isStats  { false };           // Report statistics of durations read as batch input
+
+    FlushPolicy flushPolicy;               // Output flush policy
+    size_t      flushSize { 64 * 1024 };   // Output flush size in characters, for FlushPolicy::Size
+    unsigned    threads   { 1 };           // Number of batch formatting threads
+    wstring     inputFile;                 // Batch input file name, if not the standard input stream
+    wstring     serveSocket;               // Socket path to serve requests on, for server mode
+    wstring     clientSocket;              // Socket path of the server to forward to, for client mode
+    wstring     jobsFile;                  // Job file name, or "-" for the standard input stream
+    wstring     treeRoot;                  // Directory tree to report file times for, for tree mode
+    TimeType    treeTime  { TimeType::None };  // Type of file time reported in tree mode, if given
+    wstring     newerThan;                 // Report only files with times after this, if given
+    wstring     olderThan;                 // Report only files with times before this, if given
 
     TimeSpec time1;         // Time 1 [required] (either single use, or for time difference)
     TimeSpec time2;         // Time 2 [optional] (for time difference output)
 };
 
 
-// Global Constants
-static const int secondsPerMinute       = 60;
-static const int secondsPerHour         = secondsPerMinute * 60;
-static const int secondsPerDay          = secondsPerHour * 24;
-static const int secondsPerNominalYear  = secondsPerDay * 365;
-static const int secondsPerTropicalYear = secondsPerNominalYear + (secondsPerDay / 400) * 497;   // 365+97/400 days
-
-
-// Global Variables
-static time_t currentTime;
-static tm     currentTimeLocal;
-static tm     currentTimeUTC;
-static int    timeZoneOffsetHours;      // Signed hours offset from UTC
-static int    timeZoneOffsetMinutes;    // Signed minutes offset from UTC
-
-
 //======================================================================================================================
 // Help Text
 //======================================================================================================================
@@ -125,6 +169,12 @@ usage    : timeprint [--codeChar <char>] [-%<char>]
                      [--timeZone <zone>] [-z<zone>]
                      [--now] [-n]
                      [--time <timeValue>] [-t<timeValue>]
+                     [--batch] [--stdin] [--input <file>] [--threads <count>]
+                     [--rewrite] [--stats]
+                     [--tree <dir>] [--treeTime <access|creation|modification>]
+                     [--newer <timeValue>] [--older <timeValue>]
+                     [--flush <line|exit|size>]
+                     [--jobs <file|->] [--serve <socket>] [--client <socket>]
                      [string] ... [string]
 
 This command prints time information to the standard output stream. All string
@@ -158,8 +208,9 @@ are valid.)
         the command line.
 
     --timeZone <zone>, -z<zone>
-        The --timeZone argument takes a timezone string of the form used by the
-        TZ environment variable and displays the result in that time zone. If no
+        The --timeZone argument takes a zoneinfo time zone name (such as
+        America/Los_Angeles) or a timezone string of the form used by the TZ
+        environment variable, and displays the result in that time zone. If no
         timezone is specified, the value in the TZ environment variable is used.
         If the environment variable TZ is unset, the system local time is used.
         For a description of the time zone format, use `--help timeZone`.
@@ -182,6 +233,91 @@ are valid.)
     --modify|--modified|--modification <fileName>, -m<fileName>
         Use the modification time of the named file.
 
+    --batch, --stdin
+        Read explicit time values from the standard input stream, one per
+        line, and print one formatted result line for each. Time values use
+        the `--time` syntax (see `--help timeSyntax`). If a time value is also
+        given on the command line, then each result reports the difference
+        between that time and the input time. Unrecognized input lines yield
+        an empty output line and an error message.
+
+    --input <fileName>
+        Batch mode (as for --batch), reading time values from the named file
+        instead of the standard input stream.
+
+    --threads <count>
+        Format batch input using the given number of worker threads. Output
+        order always matches input order. A count of 0 uses one thread per
+        processor. The default is 1, and the most is four per processor (or
+        64, if that is more).
+
+    --rewrite
+        Filter the standard input stream (or the `--input` file) to the
+        standard output stream, replacing each timestamp embedded in the text
+        with its formatted value, and copying all other text unchanged.
+        Timestamps are ISO 8601 date-times with a `T` separator (such as
+        `2023-11-21T08:30:00Z`, see `--help timeSyntax`), and Unix epoch times
+        of the form `@<seconds>[.<fraction>]`. If a time value is also given on
+        the command line, then each timestamp is replaced with its difference
+        from that time. Output follows the `--flush` policy; with `line`, the
+        default on a console, output is written as each block of input lines
+        is read, so this mode can follow a growing log.
+
+    --stats
+        Read pairs of explicit time values from the standard input stream (or
+        the `--input` file), one start and end time per line separated by
+        spaces or tabs, and report statistics of the durations between them:
+        count, minimum, maximum, mean, and the 50th, 90th, 99th and 99.9th
+        percentiles. Durations are printed using the delta time format (see
+        `--help deltaTime`). Percentiles are estimated to within 1% of a true
+        duration, using constant memory for any amount of input. Use
+        `--threads` to read input on multiple threads.
+
+    --tree <directory>
+        Report a time for every file and directory under the named directory,
+        one `<path><tab><time>` line each. Directories are scanned on the
+        number of threads given by `--threads`, so with more than one thread,
+        lines are not in any particular order. Symbolic links and junctions are
+        reported but not followed. If a time value is also given on the
+        command line, then each line reports the difference between that time
+        and the file time (for example, `--now` reports file ages).
+
+    --treeTime <access|creation|modification>
+        The file time reported by `--tree`. The default is `modification`.
+
+    --newer <value>, --older <value>
+        With `--tree`, report only files whose time is after (`--newer`) or
+        before (`--older`) the given explicit time, using `--time` syntax.
+
+    --flush <line|exit|size>
+        Output is buffered and written in large blocks. This option sets when
+        buffered output is written: `line` writes after each output line,
+        `exit` writes only at exit, and a number writes whenever that many
+        kilobytes of output have accumulated. The default is `line` when
+        output goes to a console, and `64` otherwise.
+
+    --jobs <fileName|->
+        Run each line of the named file (or of the standard input stream, for
+        `-`) as a complete timeprint command line, and print its results.
+        Arguments are separated by spaces, and may be enclosed in double
+        quotes. Time zones and compiled formats are shared across jobs. A
+        failed job yields an empty output line and an error message. Output
+        from the standard input stream is written after each job, so this
+        mode can be driven as a coprocess.
+
+    --serve <socket>
+        Run as a resident server, answering requests from `--client` runs on
+        the named Unix domain socket. Time zones and compiled formats are
+        cached between requests. Each request uses the client's directory,
+        TZ and default format variables. The server runs until killed. It
+        won't start if another server is running on the socket, or if the
+        socket path names some other existing file.
+
+    --client <socket>
+        Send this command's other arguments to the server on the named
+        socket, and print its results. Output and exit codes match a direct
+        run. Batch mode is not available through a server.
+
 If no output string is supplied, the format specified in the environment
 variable TIMEFORMAT is used. If this variable is not set, then the format
 defaults to "%#c". The TIMEFORMAT string must use the "%" code character.
@@ -221,6 +357,9 @@ Examples
     > timeprint %H:%M:%S
     17:03:17
 
+    > timeprint %T.%3N
+    17:03:17.042
+
     > timeprint -z UTC
     Monday, July 21, 2003 00:03:47
 
@@ -272,6 +411,7 @@ Delta Time Formatting
             d - Days
             h - Hours
             m - Minutes
+            s - Seconds
 
         If the next greater unit is followed by a zero, then the result is
         zero-padded to the appropriate width for the range of possible values.
@@ -286,7 +426,10 @@ Delta Time Formatting
             D - Days
             H - Hours
             M - Minutes
-            S - Whole seconds
+            S - Seconds
+            L - Milliseconds
+            U - Microseconds
+            N - Nanoseconds
 
         Nominal years are 365 days in length.
 
@@ -304,19 +447,25 @@ Delta Time Formatting
             H yH tH dH
             M yM tM dM hM
             S yS tS dS hS mS
+            L yL tL dL hL mL sL
+            U yU tU dU hU mU sU
+            N yN tN dN hN mN sN
 
     Decimal Precision [.[#]] (_optional_)
-        With the exception of seconds, all units will have a fractional value
-        for time differences. If the decimal precision format is omitted, the
-        then rounded whole value is printed.
+        With the exception of nanoseconds, all units will have a fractional
+        value for time differences. If the decimal precision format is
+        omitted, the then rounded whole value is printed.
 
         If the decimal point and number is specified, then the fractional
         value will be printed with the number of requested digits.
 
         If a decimal point is specified but without subsequent digits, then
         the number of digits will depend on the units. Enough digits will be
-        printed to maintain full resolution of the unit to within one second.
-        Thus, years: 8 digits, days: 5, hours: 4, minutes: 2.
+        printed to maintain full resolution of the unit to within one second,
+        or one nanosecond for milliseconds and microseconds. Thus, years: 8
+        digits, days: 5, hours: 4, minutes: 2, milliseconds: 6, and
+        microseconds: 3. Seconds take a fractional value only with an explicit
+        number of digits, such as `%_S.3`.
 
     Examples
          Given a delta time of 547,991,463 seconds, the following delta format
@@ -331,6 +480,14 @@ Delta Time Formatting
             %_Y years, %_yD days, %_dH. hours
                 '17 years, 137 days, 11.8508 hours'
 
+         Given a delta time of 1.25 seconds:
+
+            %_L ms
+                '1250 ms'
+
+            %_S.%_s0L
+                '1.250'
+
     See `--time examples` for more example uses of delta time formats.
 )";
 
@@ -387,6 +544,9 @@ Format Codes
         %M     Minute as decimal number (00-59)
         %p     AM or PM designation (locale dependent)
         %S     Seconds as a decimal number (00-59)
+        %N     Nanoseconds as a decimal number (000000000-999999999)
+        %<d>N  Fractional seconds, truncated to d digits (1-9). For example,
+               %3N gives milliseconds.
         %z     ISO 8601 offset from UTC in timezone (1 minute=1, 1 hour=100)
                If timezone cannot be determined, no characters
         %Z *   Time-zone name or abbreviation.
@@ -448,10 +608,14 @@ Time Syntax
     The time can take one of the following patterns, where the `:` characters
     are optional:
 
+        HH:MM:SS.fff
         HH:MM:SS
         HH:MM
         HH
 
+    Fractional seconds (.fff) follow a `.` or `,` character, and may have any
+    number of digits. They are kept to nanosecond resolution.
+
     The time may be followed by an optional time zone, which has the following
     pattern, where `+` represents a required `+` or `-` character.
 
@@ -471,6 +635,7 @@ Time Syntax
 
         2018-02-24T20:58:46-0800
         2018-02-25T04:58:46Z
+        2018-02-25T04:58:46.125Z
         17:57
         --05-07
         120000Z
@@ -486,11 +651,23 @@ static auto help_timeZone = LR"(
 Time Zones
 -----------
     The time zone value may be specified with the TZ environment variable,
-    or using the `--timezone` option. Time zones have the format
-    `tzn[+|-]hh[:mm[:ss]][dzn]`, where
+    or using the `--timezone` option. Time zones are either names from the
+    zoneinfo time zone database, or time zone rule strings.
+
+    Zoneinfo names, such as `America/Los_Angeles` or `Europe/Paris`, give the
+    full history of a locality's offsets and daylight saving time rules.
+    Zone files are read from the directory named by the TZDIR environment
+    variable, or from /usr/share/zoneinfo if TZDIR is unset. A leading colon
+    (as in `:Europe/Paris`) selects a zoneinfo name only. An absolute file
+    path may also be given.
+
+    Time zone rule strings have the format
+    `tzn[+|-]hh[:mm[:ss]][dzn[[+|-]hh[:mm[:ss]]][,start[/time],end[/time]]]`,
+    where
 
         tzn
-            Time-zone name, three letters or more, such as PST.
+            Time-zone name, three letters or more, such as PST, or any
+            characters enclosed in angle brackets, such as <+0530>.
 
         [+|-]hh
             The time that must be ADDED to local time to get UTC.
@@ -500,7 +677,7 @@ Time Zones
             You can experiment with the string "%#c %Z %z" and the
             `--timezone` option to ensure you understand how these work
             together. If offset hours are omitted, they are assumed to be
-            zero.
+            zero, unless tzn is itself a zoneinfo name (such as EST or UTC).
 
         [:mm]
             Minutes, prefixed with mandatory colon.
@@ -510,61 +687,74 @@ Time Zones
 
         [dzn]
             Three-letter daylight-saving-time zone such as PDT. If daylight
-            saving time is never in effect in the locality, omit dzn. The C
-            run-time library assumes the US rules for implementing the
-            calculation of Daylight Saving Time (DST).
+            saving time is never in effect in the locality, omit dzn. An
+            offset may follow; otherwise daylight saving time is one hour
+            ahead of standard time.
+
+        [,start[/time],end[/time]]
+            The dates when daylight saving time starts and ends, each of the
+            form `Mm.w.d` (day d of week w of month m, where day 0 is Sunday
+            and week 5 is the last week), `Jn` (Julian day n from 1 to 365,
+            never counting February 29), or `n` (zero-based day n from 0 to
+            365). Times default to 02:00:00 local time. If the dates are
+            omitted, the US rules for daylight saving time are used.
 
         Examples of the timezone string include the following:
 
-            UTC       Universal Coordinated Time
-            PST8      Pacific Standard Time
-            PDT+07    Pacific Daylight Time
-            NST+03:30 Newfoundland Standard Time
-            PST8PDT   Pacific Standard Time, daylight savings in effect
-            GST-1GDT  German Standard Time, daylight savings in effect
+            UTC               Universal Coordinated Time
+            PST8              Pacific Standard Time
+            PDT+07            Pacific Daylight Time
+            NST+03:30         Newfoundland Standard Time
+            PST8PDT           Pacific Standard Time, daylight savings in effect
+            GST-1GDT          German Standard Time, daylight savings in effect
+            CET-1CEST,M3.5.0,M10.5.0/3
+                              Central European Time, with European rules
+            America/New_York  US Eastern Time, from the zoneinfo database
 )";
 
 //__________________________________________________________________________________________________
 
-void help (HelpType type) {
-    // For HelpType::None, do nothing. For other help types, print corresponding help information
-    // and exit.
+wstring helpText (HelpType type) {
+    // Returns the help information for the given help type, with each part ending in a newline.
 
-    switch (type) {
-        default: return;
+    vector<const wchar_t*> parts;
 
-        case HelpType::General:
-            _putws(help_general);
-            _putws(version);
-            break;
+    switch (type) {
+        default: break;
 
-        case HelpType::Version:      _putws(version);           break;
-        case HelpType::Examples:     _putws(help_examples);     break;
-        case HelpType::DeltaTime:    _putws(help_deltaTime);    break;
-        case HelpType::FormatCodes:  _putws(help_formatCodes);  break;
-        case HelpType::TimeSyntax:   _putws(help_timeSyntax);   break;
-        case HelpType::TimeZone:     _putws(help_timeZone);     break;
+        case HelpType::General:      parts = { help_general, version };  break;
+        case HelpType::Version:      parts = { version };                break;
+        case HelpType::Examples:     parts = { help_examples };          break;
+        case HelpType::DeltaTime:    parts = { help_deltaTime };         break;
+        case HelpType::FormatCodes:  parts = { help_formatCodes };       break;
+        case HelpType::TimeSyntax:   parts = { help_timeSyntax };        break;
+        case HelpType::TimeZone:     parts = { help_timeZone };          break;
 
         case HelpType::Full:
-            _putws(help_general);
-            _putws(help_timeSyntax);
-            _putws(help_timeZone);
-            _putws(help_formatCodes);
-            _putws(help_deltaTime);
-            _putws(help_examples);
-            _putws(L"");
-            _putws(version);
+            parts = { help_general, help_timeSyntax, help_timeZone, help_formatCodes, help_deltaTime,
+                      help_examples, L"", version };
             break;
     }
 
-    exit (0);
+    wstring text;
+    for (auto part : parts) {
+        text += part;
+        text += L'\n';
+    }
+
+    return text;
 }
 
 
+
 //======================================================================================================================
 // Utility Functions
 //======================================================================================================================
 
+// When set, error messages are appended to this string instead of written to stderr. The server
+// uses this to return each request's errors to its client.
+static thread_local wstring* errorCapture = nullptr;
+
 bool errorMsg (const wchar_t *message, ...) {
     // Prints printf-style error message to stderr output stream. This function always returns false
     // (for chaining).
@@ -576,7 +766,13 @@ bool errorMsg (const wchar_t *message, ...) {
     fullMessage += message;
     fullMessage += L".\n";
 
-    vfwprintf_s (stderr, fullMessage.c_str(), arguments);
+    if (!errorCapture) {
+        vfwprintf_s (stderr, fullMessage.c_str(), arguments);
+    } else {
+        wchar_t buffer [2048];
+        auto length = _vsnwprintf_s (buffer, std::size(buffer), _TRUNCATE, fullMessage.c_str(), arguments);
+        errorCapture->append (buffer, (length < 0) ? wcslen(buffer) : length);
+    }
 
     va_end(arguments);
     return false; 
@@ -590,314 +786,256 @@ bool equalIgnoreCase (const wchar_t* str1, const wchar_t* str2) {
 
 //__________________________________________________________________________________________________
 
-bool charIn (wchar_t c, const wchar_t* list) {
-    // Return true if the given character is in the zero-terminated array of characters.
-    // Also returns true if c == 0.
-    auto i = 0;
-    while (list[i] && (c != list[i]))
-        ++i;
-    return (c == list[i]);
+// When set, environment variables are looked up in this table instead of the process environment.
+// The server uses this to apply each client's environment to its request.
+static thread_local const std::map<wstring, wstring>* environmentOverride = nullptr;
+
+wstring environmentValue (const wchar_t* name) {
+    // Returns the value of the named environment variable, or an empty string if it is not set.
+
+    if (environmentOverride) {
+        auto entry = environmentOverride->find (name);
+        return (entry == environmentOverride->end()) ? wstring() : entry->second;
+    }
+
+    wchar_t* valueEnv;
+    _wdupenv_s (&valueEnv, nullptr, name);
+
+    wstring value = valueEnv ? valueEnv : L"";
+    free (valueEnv);
+
+    return value;
 }
 
 //__________________________________________________________________________________________________
 
-int getNumIntDigits (double x) {
-    // Returns the number of digits in the given integer value.
+void toUTF8 (const wchar_t* text, size_t length, string& result) {
+    // Converts the wide text to UTF-8, replacing the contents of the result string. The result's
+    // storage is reused, so repeated conversions into the same string don't allocate.
+
+    result.clear();
+    if (length == 0) return;
+
+    // Each UTF-16 code unit yields at most three UTF-8 bytes.
+    result.resize (3 * length);
+
+    auto size = WideCharToMultiByte (
+        CP_UTF8, 0, text, static_cast<int>(length), result.data(), static_cast<int>(result.size()), nullptr, nullptr);
 
-    int n = static_cast<int>(x);
-    int nDigits = 1;
-    while (n /= 10)
-        ++ nDigits;
+    result.resize (size);
+}
 
-    return nDigits;
+string toUTF8 (const wstring& text) {
+    string result;
+    toUTF8 (text.data(), text.length(), result);
+    return result;
 }
 
 //__________________________________________________________________________________________________
 
-void getCurrentTime () {
-    // This function gets the current local time, and the corresponding local and UTC time structs.
-    // It also gets the current time zone's hour & minute offsets from UTC.
+wstring fromUTF8 (const char* text, size_t length) {
+    if (length == 0) return wstring();
+
+    auto    size = MultiByteToWideChar (CP_UTF8, 0, text, static_cast<int>(length), nullptr, 0);
+    wstring result (size, L'\0');
 
-    currentTime = std::time(nullptr);
-    localtime_s (&currentTimeLocal, &currentTime);
-    gmtime_s (&currentTimeUTC, &currentTime);
+    MultiByteToWideChar (CP_UTF8, 0, text, static_cast<int>(length), result.data(), size);
+    return result;
+}
 
-    // Figure out the local time zone's offset. Computing the difference between local and UTC times
-    // is problematic, particularly when the local time zone is changing in or out of daylight
-    // saving time. Given this, the best approach is to get the actual time zone offset from the
-    // system ftime() function family. This returns a string of the form "[+|-]HHMM".
+//__________________________________________________________________________________________________
 
-    wchar_t buffer[8];
+// UTF-8 builds set this when the standard output stream is redirected, so that output is written
+// as UTF-8 bytes instead of being converted by the C runtime to the console code page.
+static bool utf8Output = false;
 
-    wcsftime (buffer, std::size(buffer), L"%z", &currentTimeLocal);
-    timeZoneOffsetHours   = 10*(buffer[1]-L'0') + (buffer[2]-L'0');  // Parse out unsigned offset hours
-    timeZoneOffsetMinutes = 10*(buffer[3]-L'0') + (buffer[4]-L'0');  // Parse out unsigned offset minutes
+void writeText (FILE* stream, const wchar_t* text, size_t length) {
+    // Writes the text to the given stream. UTF-8 output to the standard output stream is converted
+    // once per block and written as bytes; otherwise the C runtime converts the wide text.
 
-    // Handle possible negative sign.
-    if (buffer[0] == L'-') {
-        timeZoneOffsetHours   = -timeZoneOffsetHours;
-        timeZoneOffsetMinutes = -timeZoneOffsetMinutes;
+    if (utf8Output && stream == stdout) {
+        static thread_local string bytes;
+        toUTF8 (text, length, bytes);
+        fwrite (bytes.data(), 1, bytes.size(), stream);
+    } else {
+        fputws (text, stream);
     }
 }
 
+void writeText (FILE* stream, const wstring& text) {
+    writeText (stream, text.c_str(), text.length());
+}
+
+void writeText (FILE* stream, const string& bytes) {
+    // Writes the bytes to the given stream unchanged.
+    fwrite (bytes.data(), 1, bytes.size(), stream);
+}
+
 //__________________________________________________________________________________________________
 
 wstring defaultTimeFormat (bool deltaFormat) {
     // Returns the default time format for the absolute or delta time, either from the user's
     // environment variable, or from a standard default time format.
 
-    wchar_t* timeFormatEnv;
-    wstring  defaultFormat;
-
-    if (deltaFormat) {
-        _wdupenv_s (&timeFormatEnv, nullptr, L"TimeFormat_Delta");
-        defaultFormat = timeFormatEnv ? timeFormatEnv : L"%_Y years, %_yD days, %_d0H:%_h0M:%_m0S";
-    } else {
-        _wdupenv_s (&timeFormatEnv, nullptr, L"TimeFormat");
-        defaultFormat = timeFormatEnv ? timeFormatEnv : L"%#c";
-    }
+    auto defaultFormat = environmentValue (deltaFormat ? L"TimeFormat_Delta" : L"TimeFormat");
 
-    free (timeFormatEnv);
+    if (defaultFormat.empty())
+        defaultFormat = deltaFormat ? L"%_Y years, %_yD days, %_d0H:%_h0M:%_m0S" : L"%#c";
 
     return defaultFormat;
 }
 
 
 //======================================================================================================================
-// Date/Time Parsing Functions
+// Output Buffering
 //======================================================================================================================
 
-bool parseDateTimePatternCore (
-    wchar_t*           pattern,
-    wstring::iterator& sourceIt,
-    wstring::iterator  sourceEnd,
-    vector<int>&       results)
-{
-    // This is the core functionality of the explicit date & time parsing. Returns true if the given
-    // pattern matches the source, and places the parsed integer results in the results vector.
-    // Patterns may include the following characters:
-    //
-    //     #...    A sequence of digits yielding one number
-    //     +       A sign character, either '+' or '-'. Yields +1 or -1, respectively.
-    //     -       An optional dash.
-    //     =       A mandatory dash.
-    //     :       An optional colon.
-    //     ...     Anything else must match exactly.
-
-    results.clear();
-
-    auto sourceStart = sourceIt;
-    auto numberValue = 0;
-    auto capturingNumber = false;
-
-    for (auto patternChar=pattern;  *patternChar;  ++patternChar, ++sourceIt) {
-
-        if (sourceIt == sourceEnd) return false;
-
-        if (capturingNumber && (*patternChar != '#')) {
-            results.push_back (numberValue);
-            numberValue = 0;
-            capturingNumber = false;
-        }
-
-        switch (*patternChar) {
-            // Captured elements
-            case L'#': {
-                if (!isdigit(*sourceIt)) return false;
-                numberValue = (10 * numberValue) + (*sourceIt - '0');
-                capturingNumber = true;
-                break;
-            }
-
-            case L'+': {
-                if (*sourceIt == L'-')
-                    results.push_back (-1);
-                else if (*sourceIt == L'+')
-                    results.push_back (1);
-                else
-                    return false;
-                break;
-            }
-
-            // Non-captured elements
-            case L'-': {
-                if (*sourceIt != L'-') --sourceIt;
-                break;
-            }
+template <typename CharT>
+class BasicOutputBuffer {
+    // All program output is accumulated in an output buffer, and written to the output stream in
+    // large blocks according to the flush policy. An output buffer with no stream just accumulates
+    // its text. Output is normally wide text; byte output buffers hold text that is already encoded,
+    // and copy it to the stream unchanged.
 
-            case L'=': {
-                if (*sourceIt != L'-') return false;
-                break;
-            }
+  public:
+    using String = std::basic_string<CharT>;
 
-            case L':': {
-                if (*sourceIt != L':') --sourceIt;
-                break;
-            }
+    BasicOutputBuffer (FILE* stream, FlushPolicy policy, size_t flushSize)
+      : stream(stream), policy(policy), flushSize(flushSize)
+    {
+        buffer.reserve (flushSize + 1024);
 
-            default: {
-                if (*sourceIt != *patternChar) return false;
-                break;
-            }
-        }
+        // Match the stream's own buffer to our flush size so that each flush is a single write.
+        if (stream)
+            setvbuf (stream, nullptr, _IOFBF, flushSize + 1024);
     }
 
-    if (capturingNumber)
-        results.push_back (numberValue);
-
-    return true;
-}
-
-//__________________________________________________________________________________________________
-
-bool parseDateTimePattern (
-    wchar_t*           pattern,
-    wstring::iterator& sourceIt,
-    wstring::iterator  sourceEnd,
-    vector<int>&       results)
-{
-    // Parses a date/time pattern. On failure, restores the sourceIt iterator and returns false,
-    // otherwise on success leaves the sourceIt where it ended and returns true.
+    ~BasicOutputBuffer () {
+        flush();
+    }
 
-    wstring::iterator sourceReset = sourceIt;
+    void put (CharT c) {
+        buffer += c;
+    }
 
-    if (!parseDateTimePatternCore (pattern, sourceIt, sourceEnd, results)) {
-        sourceIt = sourceReset;
-        return false;
+    void put (const CharT* str) {
+        buffer += str;
     }
 
-    return true;
-}
+    void put (const CharT* str, size_t length) {
+        buffer.append (str, length);
+    }
 
-//__________________________________________________________________________________________________
+    String& text () {
+        // Returns the pending output text, for appending formatted output in place.
+        return buffer;
+    }
 
-bool getExplicitTime (tm& resultTimeLocal, wstring::iterator specBegin, wstring::iterator specEnd) {
-    // Parses the time part of an ISO 8601 date string. Returns true on success, false on failure.
+    void endLine () {
+        // Ends the current output line, and flushes the buffer if the policy calls for it.
+        buffer += CharT('\n');
+        checkFlush();
+    }
 
-    bool gotTime = false;
-    vector<int> results;
-    wstring::iterator specIt = specBegin;
+    void putLines (const String& lines) {
+        // Appends a block of complete output lines, and flushes the buffer if the policy calls for
+        // it.
+        buffer += lines;
+        checkFlush();
+    }
 
-    if (parseDateTimePattern (L"##:##:##", specIt, specEnd, results)) {
-        resultTimeLocal.tm_hour = results[0];
-        resultTimeLocal.tm_min  = results[1];
-        resultTimeLocal.tm_sec  = results[2];
-        gotTime = true;
-    } else if (parseDateTimePattern (L"##:##", specIt, specEnd, results)) {
-        resultTimeLocal.tm_hour = results[0];
-        resultTimeLocal.tm_min  = results[1];
-        gotTime = true;
-    } else if (parseDateTimePattern (L"##", specIt, specEnd, results)) {
-        resultTimeLocal.tm_hour = results[0];
-        gotTime = true;
+    void endLines () {
+        // Ends a block of complete output lines written with put(), and flushes the buffer if the
+        // policy calls for it.
+        checkFlush();
     }
 
-    if (!gotTime) return false;
+    void flush () {
+        // Writes all buffered output to the output stream.
 
-    // Parse timezone, if any.
+        if (!stream || buffer.empty()) return;
 
-    if (specIt == specEnd) {
-        // Time was specified in local time, no conversion needed.
-        return true;
+        writeText (stream, buffer);
+        fflush (stream);
+        buffer.clear();
     }
 
-    if ((specIt[0] == L'Z') && (std::next(specIt) == specEnd)) {
-        // UTC time; convert to local. We just do this manually by applying the offset.
-        resultTimeLocal.tm_hour += timeZoneOffsetHours;
-        resultTimeLocal.tm_min  += timeZoneOffsetMinutes;
-        return true;
+    String release () {
+        // Returns the accumulated text, leaving the buffer empty.
+        String text;
+        text.swap (buffer);
+        return text;
     }
 
-    // Attempt to parse the explicit timezone from the spec.
-    auto specOffsetHours   = 0;
-    auto specOffsetMinutes = 0;
+  private:
+    FILE*       stream;      // Output stream, or null to only accumulate
+    FlushPolicy policy;      // When to write buffered output to the stream
+    size_t      flushSize;   // Buffer size that triggers a write, for FlushPolicy::Size
+    String      buffer;      // Pending output
 
-    if (parseDateTimePattern (L"+##:##", specIt, specEnd, results)) {
-        specOffsetHours   = results[0] * results[1];
-        specOffsetMinutes = results[0] * results[2];
-    } else if (parseDateTimePattern (L"+##", specIt, specEnd, results)) {
-        specOffsetHours = results[0] * results[1];
+    void checkFlush () {
+        if ((policy == FlushPolicy::Line) || ((policy == FlushPolicy::Size) && (buffer.length() >= flushSize)))
+            flush();
     }
+};
 
-    if (specIt != specEnd) return false;
+using OutputBuffer     = BasicOutputBuffer<wchar_t>;
+using ByteOutputBuffer = BasicOutputBuffer<char>;
 
-    // Convert from specified time zone to UTC, then to local time.
-    resultTimeLocal.tm_hour += -specOffsetHours   + timeZoneOffsetHours;
-    resultTimeLocal.tm_min  += -specOffsetMinutes + timeZoneOffsetMinutes;
 
-    return true;
-}
+//======================================================================================================================
+// Time Value Functions
+//======================================================================================================================
 
-//__________________________________________________________________________________________________
+template <typename CharT>
+bool explicitTimeError (const CharT* specBegin, const CharT* specEnd, size_t errorIndex) {
+    // Reports an unrecognized explicit time value, with the position of the first unrecognized
+    // character. Returns false (for chaining).
+
+    auto format = std::is_same<CharT, char>::value
+                ? L"Unrecognized explicit time: \"%.*S\" (at position %d)"
+                : L"Unrecognized explicit time: \"%.*s\" (at position %d)";
 
-bool getExplicitDate (tm& resultTime, wstring::iterator specBegin, wstring::iterator specEnd) {
-    // Parses the date part of an ISO 8601 date string. Returns true on success, false on failure.
-
-    auto gotDate = false;
-    vector<int> results;
-    wstring::iterator specIt = specBegin;
-
-    if (parseDateTimePattern (L"==##-##", specIt, specEnd, results)) {
-        resultTime.tm_mon  = results[0] - 1;
-        resultTime.tm_mday = results[1];
-        gotDate = true;
-    } else if (parseDateTimePattern (L"####-##-##", specIt, specEnd, results)) {
-        resultTime.tm_year = results[0] - 1900;
-        resultTime.tm_mon  = results[1] - 1;
-        resultTime.tm_mday = results[2];
-        gotDate = true;
-    } else if (parseDateTimePattern (L"####-###", specIt, specEnd, results)) {
-        resultTime.tm_year = results[0] - 1900;
-        resultTime.tm_mon  = 0;
-        resultTime.tm_mday = results[1];
-        gotDate = true;
-    } else if (parseDateTimePattern (L"####=##", specIt, specEnd, results)) {
-        resultTime.tm_year = results[0] - 1900;
-        resultTime.tm_mon  = results[1] - 1;
-        gotDate = true;
-    } else if (parseDateTimePattern (L"####", specIt, specEnd, results)) {
-        resultTime.tm_year = results[0] - 1900;
-        gotDate = true;
-    }
-
-    return gotDate && (specIt == specEnd);
+    return errorMsg (format, static_cast<int>(specEnd - specBegin), specBegin, static_cast<int>(errorIndex + 1));
 }
 
 //__________________________________________________________________________________________________
 
-bool getExplicitDateTime (time_t& result, wstring timeSpec) {
-    // Parses an ISO 8601 formatted date/time string. Returns true on success, false on failure.
+Time timeFromFileTime (const FILETIME& fileTime) {
+    // Converts a Windows file time, in 100-nanosecond intervals since 1601-01-01T00:00:00Z, to a
+    // time value.
 
-    tm timeStruct = currentTimeLocal;
+    const int64_t intervalsPerSecond = 10000000;
+    const int64_t epochIntervals     = 116444736000000000;   // 1601-01-01 to 1970-01-01
 
-    auto dateTimeSep = std::find (timeSpec.begin(), timeSpec.end(), 'T');
-    bool successResult;
+    auto intervals = static_cast<int64_t>((uint64_t(fileTime.dwHighDateTime) << 32) | fileTime.dwLowDateTime)
+                   - epochIntervals;
+    auto seconds   = intervals / intervalsPerSecond;
+    auto remainder = intervals % intervalsPerSecond;
 
-    if (dateTimeSep != timeSpec.end()) {
-        successResult = getExplicitTime (timeStruct, std::next(dateTimeSep), timeSpec.end())
-                     && getExplicitDate (timeStruct, timeSpec.begin(), dateTimeSep);
-    } else {
-        successResult = getExplicitTime (timeStruct, timeSpec.begin(), timeSpec.end())
-                     || getExplicitDate (timeStruct, timeSpec.begin(), timeSpec.end());
+    if (remainder < 0) {
+        remainder += intervalsPerSecond;
+        --seconds;
     }
 
-    if (successResult) {
-        if (timeStruct.tm_year < 70)
-            return errorMsg(L"Cannot handle dates before 1970");
-        timeStruct.tm_isdst = -1;         // DST status unknown
-        result = mktime (&timeStruct);
-    }
+    return Time (seconds, static_cast<int32_t>(remainder * 100));
+}
+
+//__________________________________________________________________________________________________
 
-    return successResult;
+bool earlier (Time a, Time b) {
+    // Returns true if time a is before time b.
+    return (a.seconds < b.seconds) || ((a.seconds == b.seconds) && (a.nanoseconds < b.nanoseconds));
 }
 
 //__________________________________________________________________________________________________
 
-bool getTimeFromSpec (time_t& result, const TimeSpec& spec) {
-    // Gets the time specified by the given time specification.
+bool getTimeFromSpec (const Context& context, Time& result, const TimeSpec& spec) {
+    // Gets the time specified by the given time specification. File times are read at their full
+    // file system resolution.
 
     if (spec.type == TimeType::Now) {
-        result = currentTime;
+        result = context.currentTime();
         return true;
     }
 
@@ -905,27 +1043,29 @@ bool getTimeFromSpec (time_t& result, const TimeSpec& spec) {
        || (spec.type == TimeType::Creation)
        || (spec.type == TimeType::Modification)) {
 
-        struct _stat stat;    // File Status Data
+        WIN32_FILE_ATTRIBUTE_DATA attributes;     // File Status Data
 
         auto fileName = spec.value.c_str();
 
-        if (0 != _wstat(fileName, &stat))
+        if (!GetFileAttributesExW (fileName, GetFileExInfoStandard, &attributes))
             return errorMsg(L"Couldn't get status of \"%s\"", fileName);
 
-        switch (spec.type) {
-            case TimeType::Access:        result = stat.st_atime; break;
-            case TimeType::Creation:      result = stat.st_ctime; break;
-            case TimeType::Modification:  result = stat.st_mtime; break;
-        }
+        result = timeFromFileTime (
+              (spec.type == TimeType::Access)   ? attributes.ftLastAccessTime
+            : (spec.type == TimeType::Creation) ? attributes.ftCreationTime
+            :                                     attributes.ftLastWriteTime);
         return true;
     }
 
     if (spec.type == TimeType::Explicit) {
-        auto timeString = spec.value;
-        if (getExplicitDateTime(result, timeString))
-            return true;
+        auto   specBegin = spec.value.data();
+        auto   specEnd   = specBegin + spec.value.length();
+        size_t errorIndex;
+
+        if (!context.parse (specBegin, specEnd, result, &errorIndex))
+            return explicitTimeError (specBegin, specEnd, errorIndex);
 
-        return errorMsg(L"Unrecognized explicit time: \"%s\"", timeString.c_str());
+        return true;
     }
 
     return false;   // Unrecognized time type
@@ -933,562 +1073,2185 @@ bool getTimeFromSpec (time_t& result, const TimeSpec& spec) {
 
 //__________________________________________________________________________________________________
 
-bool calcTime (
-    const Parameters& params,            // Command parameters
-    tm&               timeValue,         // Output time value
-    time_t&           deltaTimeSeconds)  // Output time delta in seconds
-{
-    // This function computes the time results and then sets the timeValue and deltaTimeSeconds
-    // parameters. This function returns true on success, false on failure.
+bool initTime (Context& context, const Parameters& params) {
+    // Establishes the context's time zone and snapshots the current time. This is done once per
+    // context, before any time values are computed. Returns true on success, false on failure.
 
-    // If an alternate time zone was specified, then we need to set the TZ environment variable.
-    if (!params.zone.empty()) {
-        _wputenv_s (L"TZ", params.zone.c_str());
-    }
+    if (!params.zone.empty() && !context.setTimeZone (params.zone))
+        return errorMsg (L"Unrecognized time zone (%s)", params.zone.c_str());
 
-    getCurrentTime();    // Snapshot current time data to global variables.
+    return true;
+}
 
-    time_t time1;
-    if (!getTimeFromSpec (time1, params.time1)) return false;
+//__________________________________________________________________________________________________
 
-    if (params.time2.type == TimeType::None) {      // Reporting a single absolute time.
-        deltaTimeSeconds = 0;
-        localtime_s (&timeValue, &time1);
-    } else {                                        // Reporting a time diffence
-        time_t time2;
-        if (!getTimeFromSpec (time2, params.time2)) return false;
-        deltaTimeSeconds = (time1 < time2) ? (time2 - time1) : (time1 - time2);
-        gmtime_s (&timeValue, &deltaTimeSeconds);
-    }
+bool calcTime (
+    Context&          context,  // Conversion context, initialized from the parameters
+    const Parameters& params,   // Command parameters
+    Time&             time1,    // Output primary time value
+    Time&             time2)    // Output secondary time value, used only for time differences
+{
+    // This function computes the time values to report. This function returns true on success,
+    // false on failure.
+
+    if (!initTime (context, params)) return false;
+
+    time2 = Time();
+    if (!getTimeFromSpec (context, time1, params.time1)) return false;
+    if (params.isDelta && !getTimeFromSpec (context, time2, params.time2)) return false;
 
     return true;
 }
 
 
 //======================================================================================================================
-// Delta Time Processing
+// Batch Processing
 //======================================================================================================================
 
-bool getDeltaNumberFormat (
-    wstring::iterator& formatIterator,
-    const wstring::iterator& formatEnd,
-    wchar_t& thousandsChar,
-    wchar_t& decimalChar)
-{
-    // This function parses the thousands separator and decimal point formatting sequence, if it
-    // exists. On return, `thousandsChar` will contain the thousands character, or zero if no
-    // thousands character is to be printed, and `decimalChar` will contain the decimal character to
-    // use, or 0 to use a '.' decimal point.
+class BatchRun {
+    // The state shared by all lines of a batch run, established once before any input is read.
 
-    thousandsChar = 0;
-    decimalChar = 0;
+  public:
+    Context context;                    // Time zone and current time
+    Format  format;                     // Compiled output format
+    bool    isDelta { false };          // Report differences from the reference time
+    Time    referenceTime;              // Reference time for time differences
+};
 
-    if (*formatIterator == L'\'') {
-        if (++formatIterator == formatEnd) return false;
-        thousandsChar = *formatIterator;
-        if (++formatIterator == formatEnd) return false;
-        decimalChar = *formatIterator;
-        if (++formatIterator == formatEnd) return false;
+class BatchChunk {
+    // A block of batch input lines and its formatted output. Input read from a stream is held in
+    // the chunk's own buffer, while input from a mapped file is viewed in place.
 
-        if (thousandsChar == L'0')    // '0' indicates no thousands character.
-            thousandsChar = 0;
-    }
+  public:
+    size_t      sequence { 0 };            // Position of this chunk in the input
+    string      buffer;                    // Input text read from a stream, a whole number of lines
+    const char* mappedBegin { nullptr };   // Start of input text in a mapped file, if not buffered
+    const char* mappedEnd   { nullptr };   // End of input text in a mapped file
+    wstring     output;                    // Formatted output
+    bool        success { true };          // All lines in the chunk were processed successfully
+
+    const char* inputBegin () const { return mappedBegin ? mappedBegin : buffer.data(); }
+    const char* inputEnd ()   const { return mappedBegin ? mappedEnd   : buffer.data() + buffer.length(); }
+};
 
-    return true;
-}
+const size_t batchChunkSize  = 1024 * 1024;         // Nominal size of stream input chunks, in bytes
+const size_t mappedChunkSize = 2 * 1024 * 1024;     // Nominal size of mapped input chunks (one large page)
 
 //__________________________________________________________________________________________________
 
-bool printDeltaFunc (
-    wstring::iterator&       formatIterator,     // Pointer to delta format after '%_'
-    const wstring::iterator& formatEnd,          // Format string end
-    time_t                   deltaTimeSeconds)   // Time difference when comparing two times
-{
-    if (formatIterator == formatEnd) return false;
+class BatchInput {
+    // Supplies batch input as a sequence of line-aligned chunks, either read from a stream or
+    // scanned in place from a memory-mapped file.
 
-    wchar_t thousandsChar;  // Thousands-separator character, 0=none
-    wchar_t decimalChar;    // Decimal character
-    if (!getDeltaNumberFormat (formatIterator, formatEnd, thousandsChar, decimalChar))
-        return false;
+  public:
+    // With partial reads, each stream read returns whatever input is available, so that piped
+    // input is handled as it arrives. Otherwise each read fills a whole chunk unless input ends.
+    BatchInput (FILE* stream, bool partialReads) : stream(stream), partialReads(partialReads) {}
+
+    ~BatchInput () {
+        if (mapView)                                UnmapViewOfFile (mapView);
+        if (mapping)                                CloseHandle (mapping);
+        if (file && file != INVALID_HANDLE_VALUE)   CloseHandle (file);
+    }
 
-    // Parse modulo unit, if one exists.
-    wchar_t moduloUnit  = *formatIterator++;
-    double  moduloValue = 0;
+    bool mapFile (const wstring& fileName) {
+        // Maps the named file for reading in place. Returns false on failure.
 
-    switch (moduloUnit) {
-        case L'y':  moduloValue = secondsPerNominalYear;   break;
-        case L't':  moduloValue = secondsPerTropicalYear;  break;
-        case L'd':  moduloValue = secondsPerDay;           break;
-        case L'h':  moduloValue = secondsPerHour;          break;
-        case L'm':  moduloValue = secondsPerMinute;        break;
+        file = CreateFileW (fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
 
-        default:
-            moduloUnit = 0;
-            --formatIterator;
-            break;
-    }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx (file, &fileSize))
+            return false;
 
-    // Delta value, scaled
-    double deltaValue = moduloUnit ? fmod(deltaTimeSeconds,moduloValue) : deltaTimeSeconds;
+        stream = nullptr;
+        if (fileSize.QuadPart == 0)     // Empty files cannot be mapped, and have no input.
+            return true;
 
-    // Parse delta unit.
+        mapping = CreateFileMappingW (file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return false;
 
-    if (formatIterator == formatEnd) return false;
+        mapView = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!mapView)
+            return false;
 
-    auto unitType = *formatIterator++;
-    auto leadingZeros = (moduloUnit && (unitType == '0')) ? 1 : 0;
+        mapPosition = static_cast<const char*>(mapView);
+        mapEnd      = mapPosition + fileSize.QuadPart;
+        prefetch (mapPosition);
+        return true;
+    }
 
-    if (leadingZeros) {
-        if (formatIterator == formatEnd) return false;
-        unitType = *formatIterator++;
+    bool next (BatchChunk& chunk) {
+        // Gets the next chunk of input. Returns false at end of input.
+        return stream ? readChunk (chunk.buffer) : nextMappedChunk (chunk);
     }
 
-    switch (unitType) {
-        case L'Y': {
-            if (moduloUnit != 0) return false; // There are no legal modulo unit prefixes for year.
-            deltaValue /= secondsPerNominalYear;
-            break;
-        }
+  private:
+    FILE*       stream;                   // Input stream, or null for mapped input
+    bool        partialReads;             // Stream reads return input as it arrives
+    string      readBuffer;               // Stream read buffer, one chunk long
+    string      carry;                    // Partial line carried over to the next stream chunk
+    HANDLE      file    { nullptr };      // Mapped input file
+    HANDLE      mapping { nullptr };      // Mapped input file mapping object
+    void*       mapView { nullptr };      // Mapped input file view
+    const char* mapPosition { nullptr };  // Start of the next mapped chunk
+    const char* mapEnd      { nullptr };  // End of mapped input
 
-        case L'T': {
-            if (moduloUnit != 0) return false; // There are no legal modulo unit prefixes for year.
-            deltaValue /= secondsPerTropicalYear;
-            break;
-        }
+    bool readChunk (string& chunk) {
+        // Reads the next chunk of input from the stream. The chunk always ends at a line boundary,
+        // and any partial trailing line is carried over to the next chunk.
 
-        case L'D': {
-            if (!charIn(moduloUnit, L"ty")) return false; // Filter out invalid modulo unit prefixes.
-            deltaValue /= secondsPerDay;
-            if (leadingZeros)
-                leadingZeros = getNumIntDigits (moduloValue/secondsPerDay);
-            break;
-        }
+        chunk.swap (carry);
+        carry.clear();
 
-        case L'H': {
-            if (!charIn(moduloUnit, L"tyd")) return false; // Filter out invalid modulo unit prefixes.
-            deltaValue /= secondsPerHour;
-            if (leadingZeros)
-                leadingZeros = getNumIntDigits (moduloValue/secondsPerHour);
-            break;
-        }
+        readBuffer.resize (batchChunkSize);     // Allocated once, on the first read
 
-        case L'M': {
-            if (!charIn(moduloUnit, L"tydh")) return false; // Filter out invalid modulo unit prefixes.
-            deltaValue /= secondsPerMinute;
-            if (leadingZeros)
-                leadingZeros = getNumIntDigits (moduloValue/secondsPerMinute);
-            break;
-        }
+        // Read until the chunk holds at least one complete line, or input ends.
 
-        case L'S': {
-            if (!charIn(moduloUnit, L"tydhm")) return false; // Filter out invalid modulo unit prefixes.
-            if (leadingZeros)
-                leadingZeros = getNumIntDigits (moduloValue);
-            break;
-        }
+        while (true) {
+            auto bytesRead = partialReads
+                ? static_cast<size_t>(std::max (0, _read (_fileno(stream), readBuffer.data(), static_cast<unsigned>(batchChunkSize))))
+                : fread (readBuffer.data(), 1, batchChunkSize, stream);
 
-        default: return false;
-    }
+            if (bytesRead == 0)
+                return !chunk.empty();     // Final unterminated line, if any
 
-    // Determine the precision of the output value.
+            // Carry any trailing partial line over to the next chunk. Only the new input is searched
+            // for a line end, since the input before it has none.
 
-    std::wostringstream output;            // Number value string
-    auto               precision = 0;     // Output decimal precision
+            auto readEnd = readBuffer.data() + bytesRead;
+            auto lineEnd = readEnd;
+            while ((lineEnd > readBuffer.data()) && (lineEnd[-1] != '\n'))
+                --lineEnd;
 
-    if (unitType == L'S') {
-        // Seconds have no fractional value.
-    } else if ((formatIterator == formatEnd) || (*formatIterator != L'.')) {
-        deltaValue = floor(deltaValue);
-    } else {
-        ++formatIterator;
-        if ((formatIterator == formatEnd ) || !isdigit(*formatIterator)) {
-            switch (unitType) {
-                case L'T':
-                case L'Y': precision = 8; break;
-                case L'D': precision = 5; break;
-                case L'H': precision = 4; break;
-                case L'M': precision = 2; break;
+            if (lineEnd == readBuffer.data()) {
+                chunk.append (readBuffer.data(), bytesRead);
+                continue;
             }
-        } else {
-            while ((formatIterator != formatEnd) && isdigit(*formatIterator))
-                precision = 10*precision + (*formatIterator++ - L'0');
+
+            chunk.append (readBuffer.data(), lineEnd);
+            carry.assign (lineEnd, readEnd);
+            return true;
         }
     }
 
-    // Get the string value of the deltaValue with the requested precision.
-    output << std::fixed << std::setprecision(precision);
-    if (leadingZeros)
-        output << std::setfill(L'0') << std::setw(leadingZeros);
-    output << deltaValue;
-    wstring outputString = output.str();
+    bool nextMappedChunk (BatchChunk& chunk) {
+        // Views the next chunk of the mapped file in place. Chunks are a whole number of large
+        // pages, extended to the end of the line that straddles the chunk boundary.
 
-    auto decimalPointIndex = outputString.rfind(L'.');
+        if (mapPosition == mapEnd)
+            return false;
 
-    // Replace decimal point if requested.
-    if (decimalChar && (decimalPointIndex != wstring::npos))
-        outputString.replace(decimalPointIndex, 1, 1, decimalChar);
+        auto chunkEnd = (static_cast<size_t>(mapEnd - mapPosition) <= mappedChunkSize)
+                      ? mapEnd : std::find (mapPosition + mappedChunkSize, mapEnd, '\n');
+        if (chunkEnd != mapEnd)
+            ++chunkEnd;
 
-    // Insert thousands separator character if requested.
-    if (thousandsChar) {
-        auto kGroupIndex = 0;
+        chunk.mappedBegin = mapPosition;
+        chunk.mappedEnd   = chunkEnd;
+        mapPosition       = chunkEnd;
 
-        if (decimalPointIndex == wstring::npos)
-            kGroupIndex = static_cast<int>(outputString.length() - 3);
-        else {
-            kGroupIndex = static_cast<int>(decimalPointIndex - 3);
-        }
+        prefetch (mapPosition);
+        return true;
+    }
+
+    void prefetch (const char* chunkStart) {
+        // Hints that the chunk at the given position will be read soon, so that paging it in
+        // overlaps the formatting of the current chunk.
+
+        auto size = std::min (static_cast<size_t>(mapEnd - chunkStart), mappedChunkSize);
+        if (size == 0) return;
+
+        WIN32_MEMORY_RANGE_ENTRY range { const_cast<char*>(chunkStart), size };
+        PrefetchVirtualMemory (GetCurrentProcess(), 1, &range, 0);
+    }
+};
+
+//__________________________________________________________________________________________________
+
+bool processBatchChunk (
+    const BatchRun& run,        // Batch run state
+    const char*     begin,      // Start of input lines
+    const char*     end,        // End of input lines
+    OutputBuffer&   output)     // Output destination
+{
+    // Formats each explicit time value in the given block of input lines. Returns true if all lines
+    // were processed successfully.
+
+    auto success = true;
+
+    while (begin < end) {
+        auto lineBegin = begin;
+        auto lineEnd   = std::find (begin, end, '\n');
+
+        begin = (lineEnd == end) ? end : std::next(lineEnd);
+
+        while ((lineEnd > lineBegin) && (lineEnd[-1] == '\r'))
+            --lineEnd;
+
+        Time   inputTime;
+        size_t errorIndex;
+
+        if (lineBegin == lineEnd) {
+            output.endLine();
+        } else if (!run.context.parse (lineBegin, lineEnd, inputTime, &errorIndex)) {
+            explicitTimeError (lineBegin, lineEnd, errorIndex);
+            output.endLine();
+            success = false;
+        } else {
+            if (run.isDelta)
+                run.context.formatDelta (output.text(), run.format, run.referenceTime, inputTime);
+            else
+                run.context.format (output.text(), run.format, inputTime);
 
-        while (kGroupIndex > 0) {
-            outputString.insert (kGroupIndex, 1, thousandsChar);
-            kGroupIndex -= 3;
+            output.endLine();
         }
     }
 
-    fputws (outputString.c_str(), stdout);
-    return true;
+    return success;
 }
 
 //__________________________________________________________________________________________________
 
-void printDelta (
-    wstring::iterator&       formatIterator,     // Pointer to delta format after '%_'
-    wchar_t                  codeChar,           // Format Code Character
-    const wstring::iterator& formatEnd,          // Format string end
-    time_t                   deltaTimeSeconds)   // Time difference when comparing two times
-{
-    // This function attempts to print the time delta format. If the format is bad, then print the
-    // format substring as-is and restore the format string pointer to continue.
+class BatchPipeline {
+    // Coordinates a parallel batch run. A reader thread splits the input into line-aligned chunks,
+    // worker threads format chunks concurrently, and the writer emits formatted chunks in input
+    // order. At most `maxChunks` chunks are in flight at any time, which caps memory use.
+
+  public:
+    explicit BatchPipeline (size_t maxChunks) : slots(maxChunks) {}
+
+    void addWork (BatchChunk& chunk) {
+        // Reader: waits for a free slot, then queues the chunk for the workers.
 
-    auto formatRestart = formatIterator;
+        std::unique_lock<std::mutex> lock (mutex);
+        slotFree.wait (lock, [this]{ return inFlight < slots.size(); });
 
-    if (!printDeltaFunc(formatIterator, formatEnd, deltaTimeSeconds)) {
-        putwchar (codeChar);
-        putwchar (L'_');
-        formatIterator = formatRestart;
+        chunk.sequence = nextRead++;
+        ++inFlight;
+        work.push_back (std::move(chunk));
+        workReady.notify_one();
+    }
+
+    void endInput () {
+        // Reader: signals that no more chunks will be queued.
+        std::lock_guard<std::mutex> lock (mutex);
+        inputDone = true;
+        workReady.notify_all();
+        resultReady.notify_all();
     }
-}
 
+    bool getWork (BatchChunk& chunk) {
+        // Worker: takes the next chunk to format. Returns false when all input has been taken.
 
-//======================================================================================================================
-// Results Printing
-//======================================================================================================================
+        std::unique_lock<std::mutex> lock (mutex);
+        workReady.wait (lock, [this]{ return inputDone || !work.empty(); });
+        if (work.empty()) return false;
 
-void printResults (
-    wstring   format,             // The format string, possibly with escape sequences and format codes
-    wchar_t   codeChar,           // The format code character (normally %)
-    const tm& timeValue,          // The primary time value to use
-    time_t    deltaTimeSeconds)   // Time difference when comparing two times
-{
-    // This procedure scans through the format string, emitting expanded codes and escape sequences
-    // along the way.
+        chunk = std::move (work.front());
+        work.pop_front();
+        return true;
+    }
+
+    void addResult (BatchChunk& chunk) {
+        // Worker: hands a formatted chunk to the writer.
+        std::lock_guard<std::mutex> lock (mutex);
+        auto sequence = chunk.sequence;
+        slots[sequence % slots.size()] = std::move (chunk);
+        slotFilled[sequence % slots.size()] = true;
+        resultReady.notify_all();
+    }
 
-    auto formatEnd = format.end();
+    bool getResult (BatchChunk& chunk) {
+        // Writer: takes the next formatted chunk in input order. Returns false when all chunks have
+        // been written.
 
-    for (auto formatIterator = format.begin();  formatIterator != formatEnd;  ++formatIterator) {
-        const auto buffSize = 1024;
-        wchar_t    outputBuffer [buffSize];     // Intermediate Output Buffer
+        std::unique_lock<std::mutex> lock (mutex);
+        auto slot = nextWrite % slots.size();
+        resultReady.wait (lock, [&]{ return slotFilled[slot] || (inputDone && nextWrite == nextRead); });
+        if (!slotFilled[slot]) return false;
 
-        // Handle backslash sequences, unless backslash is the alternate escape character.
+        chunk = std::move (slots[slot]);
+        slotFilled[slot] = false;
+        ++nextWrite;
+        --inFlight;
+        slotFree.notify_one();
+        return true;
+    }
+
+  private:
+    std::mutex              mutex;
+    std::condition_variable slotFree;           // Signaled when a chunk slot is released
+    std::condition_variable workReady;          // Signaled when work is queued or input ends
+    std::condition_variable resultReady;        // Signaled when a chunk is formatted or input ends
+    std::deque<BatchChunk>  work;               // Chunks waiting to be formatted
+    vector<BatchChunk>      slots;              // Formatted chunks, indexed by sequence modulo size
+    vector<bool>            slotFilled = vector<bool>(slots.size(), false);
+    size_t                  inFlight  { 0 };    // Chunks read but not yet written
+    size_t                  nextRead  { 0 };    // Sequence number of the next chunk read
+    size_t                  nextWrite { 0 };    // Sequence number of the next chunk to write
+    bool                    inputDone { false };
+};
 
-        if ((*formatIterator == L'\\') && (codeChar != L'\\')) {
-            ++formatIterator;
+//__________________________________________________________________________________________________
 
-            switch (*formatIterator) {
+// Processes one chunk of batch input on the given worker thread, setting the chunk's output.
+// Returns true if all lines in the chunk were processed successfully.
+using ChunkProcessor = std::function<bool (unsigned worker, BatchChunk& chunk)>;
 
-                // If the string ends with a \, then just emit the \.
-                case 0:     putwchar(L'\\');  break;
+bool runBatchParallel (BatchInput& input, unsigned threadCount, const ChunkProcessor& process, OutputBuffer& output) {
+    // Processes batch input using a reader thread, `threadCount` workers, and the calling thread
+    // as the ordered writer. Returns true if all input lines were processed successfully.
 
-                // Recognized \-sequences are handled here.
-                case L'n':  putwchar(L'\n');  break;
-                case L't':  putwchar(L'\t');  break;
-                case L'b':  putwchar(L'\b');  break;
-                case L'r':  putwchar(L'\r');  break;
-                case L'a':  putwchar(L'\a');  break;
+    BatchPipeline pipeline (2 * threadCount);
 
-                // Unrecognized \-sequences resolve to the escaped character.
-                default:
-                    putwchar(*formatIterator);
-                    break;
+    std::thread reader ([&]{
+        BatchChunk chunk;
+        while (input.next (chunk)) {
+            pipeline.addWork (chunk);
+            chunk = BatchChunk();
+        }
+        pipeline.endInput();
+    });
+
+    vector<std::thread> workers;
+    for (unsigned i = 0;  i < threadCount;  ++i) {
+        workers.emplace_back ([&, i]{
+            BatchChunk chunk;
+            while (pipeline.getWork (chunk)) {
+                chunk.success = process (i, chunk);
+                chunk.buffer.clear();
+                pipeline.addResult (chunk);
             }
+        });
+    }
+
+    auto success = true;
+    BatchChunk chunk;
 
-        } else if (*formatIterator == codeChar) {
+    while (pipeline.getResult (chunk)) {
+        output.putLines (chunk.output);
+        success = success && chunk.success;
+    }
 
-            const static auto legalCodes = L"aAbBcCdDeFgGhHiIjmMnprRStTuUVwWxXyYzZ";
+    reader.join();
+    for (auto& worker : workers)
+        worker.join();
 
-            wchar_t token[4];    // Code Token Word
+    return success;
+}
 
-            ++formatIterator;
+//__________________________________________________________________________________________________
 
-            if (*formatIterator == L'_') {
-                printDelta (++formatIterator, codeChar, formatEnd, deltaTimeSeconds);
-                --formatIterator;  // Reset iterator for loop increment.
+bool startRun (const Parameters& params, BatchRun& run) {
+    // Establishes the run state shared by all input. The format string is compiled and the time
+    // zone and current time are established once for the entire run. Returns true on success,
+    // false on failure.
 
-            } else if (*formatIterator == L'-' || isdigit(*formatIterator)) {
-                // Numeric prefixed code.
-                auto saveMark = formatIterator;     // Mark start in case of parse error.
+    if (!initTime (run.context, params))
+        return false;
 
-                auto numPrefix = 0;
-                auto numSign = 1;
-                if (*formatIterator == L'-') {
-                    ++formatIterator;
-                    numSign = -1;
-                }
+    run.format  = Format (params.format, params.codeChar);
+    run.isDelta = params.isDelta;
 
-                // Get the leading integer value before the code.
-                wchar_t c;
-                while (c = *formatIterator++, c && isdigit(c))
-                    numPrefix = (10 * numPrefix) + (c - L'0');
-
-                numPrefix *= numSign;
-
-                const static auto legalPrefixedCodes = L"a";
-                if (!c || !wcschr(legalPrefixedCodes, c) || numPrefix < 1) {
-                    // If the string ended without a code character, or it's not a code that can
-                    // take a numeric prefix, or the prefix is out of range, then reset and just
-                    // emit without interpretation.
-                    formatIterator = saveMark;
-                    putwchar(codeChar);
-                    putwchar(*formatIterator);
-                } else {
-                    // Only %a can take a numeric prefix for now.
-                    wcsftime (outputBuffer, std::size(outputBuffer), L"%A", &timeValue);
-                    if (numPrefix < wcslen(outputBuffer))
-                        outputBuffer[numPrefix] = 0;
-                    fputws (outputBuffer, stdout);
-                    --formatIterator;
-                }
+    if (run.isDelta && !getTimeFromSpec (run.context, run.referenceTime, params.time1))
+        return false;
 
-            } else if (*formatIterator == codeChar) {
-                putwchar (codeChar);
+    return true;
+}
 
-            } else if ((*formatIterator != L'#') && !wcschr(legalCodes, *formatIterator)) {
-                // Print out illegal codes as-is.
-                putwchar (codeChar);
-                putwchar (*formatIterator);
+//__________________________________________________________________________________________________
 
-            } else if ((formatIterator[0] == L'#') && !wcschr(legalCodes, formatIterator[1])) {
-                // Print out illegal '#'-prefixed codes as-is.
-                ++formatIterator;
-                putwchar (codeChar);
-                putwchar (L'#');
-                putwchar (*formatIterator);
+bool startBatch (const Parameters& params, BatchInput& input, BatchRun& run) {
+    // Opens the batch input file, if any, and establishes the run state shared by all input.
+    // Returns true on success, false on failure.
 
-            } else if (*formatIterator == L'i') {
+    if (!params.inputFile.empty() && !input.mapFile (params.inputFile))
+        return errorMsg (L"Couldn't open input file \"%s\"", params.inputFile.c_str());
 
-                wcsftime (outputBuffer, std::size(outputBuffer), L"%FT%T%z", &timeValue);
-                fputws (outputBuffer, stdout);
+    return startRun (params, run);
+}
 
-            } else {
+//__________________________________________________________________________________________________
 
-                // Standard legal strftime() Code Sequences
-                token[0] = L'%';
-                token[1] = *formatIterator;
-                token[2] = 0;
+bool runBatch (const Parameters& params, OutputBuffer& output) {
+    // Formats each explicit time value read from the standard input stream or the input file.
+    // Returns true if all input lines were processed successfully.
 
-                if (*formatIterator == L'#') {
-                    token[2] = *++formatIterator;
-                    token[3] = 0;
-                }
+    // Line-flushed output handles piped input as it arrives; otherwise input is read in full chunks.
+    BatchInput input (stdin, params.flushPolicy == FlushPolicy::Line);
+    BatchRun   run;
 
-                wcsftime (outputBuffer, std::size(outputBuffer), token, &timeValue);
-                fputws (outputBuffer, stdout);
-            }
+    if (!startBatch (params, input, run))
+        return false;
 
-        } else {
-            // All unescaped characters are emitted as-is.
-            if (*formatIterator)
-                putwchar (*formatIterator);
-        }
+    if (params.threads > 1) {
+        return runBatchParallel (input, params.threads, [&](unsigned, BatchChunk& chunk) {
+            OutputBuffer chunkOutput (nullptr, FlushPolicy::Exit, 2 * (chunk.inputEnd() - chunk.inputBegin()));
+            auto success = processBatchChunk (run, chunk.inputBegin(), chunk.inputEnd(), chunkOutput);
+            chunk.output = chunkOutput.release();
+            return success;
+        }, output);
     }
 
-    putwchar (L'\n');
+    auto       success = true;
+    BatchChunk chunk;
+
+    while (input.next (chunk))
+        success = processBatchChunk (run, chunk.inputBegin(), chunk.inputEnd(), output) && success;
+
+    return success;
 }
 
 
 //======================================================================================================================
-// Command-Option Processing
+// Duration Statistics
 //======================================================================================================================
 
-OptionType getOptionType (int& argi, int& paramOffset, wchar_t* argv[]) {
-    // This function returns the type of the current option (indexed by `argi`). The option
-    // parameter may immediately follow a single-letter option (for example, `-t12:00`). In this
-    // case, `paramOffset` will be 2 and `argi` will not change, otherwise `argi` will be
-    // incremented and `paramOffset` will be 0. Finally, the option type will be returned.
-    // Unrecognized options will return OptionType::None, `argi` will be left unchanged, and
-    // paramOffset will be 0.
+class DurationSketch {
+    // A streaming summary of durations: count, exact minimum, maximum and mean, and a DDSketch of
+    // the distribution for quantiles. The sketch counts durations in buckets whose bounds grow
+    // geometrically by `gamma`, so that the bucket holding any quantile estimates it to within
+    // `relativeAccuracy`. Memory is fixed, and sketches of separate inputs merge exactly by adding
+    // their bucket counts.
 
-    auto arg = argv[argi];
-    paramOffset = 0;
-    auto optionType = OptionType::None;
+  public:
+    uint64_t count { 0 };
+    Time     min;
+    Time     max;
+
+    void add (Time duration) {
+        if ((count == 0) || earlier (duration, min)) min = duration;
+        if ((count == 0) || earlier (max, duration)) max = duration;
+
+        ++count;
+        secondsSum     += duration.seconds;
+        nanosecondsSum += duration.nanoseconds;
+
+        auto nanoseconds = toNanoseconds (duration);
+        if (nanoseconds < 1)
+            ++zeroCount;
+        else
+            ++buckets[std::min (static_cast<int>(ceil (log (nanoseconds) / logGamma)), bucketCount - 1)];
+    }
 
-    // Check double-dash options and other options that take no arguments.
+    void merge (const DurationSketch& other) {
+        if (other.count == 0) return;
 
-    struct {
-        const wchar_t* optString;
-        OptionType     type;
-    } optionStrings[] = {
-        { L"/?",             OptionType::Help },
-        { L"-n",             OptionType::Now },
-        { L"--accessed",     OptionType::AccessTime },
-        { L"--access",       OptionType::AccessTime },
-        { L"--codeChar",     OptionType::CodeChar },
-        { L"--created",      OptionType::CreationTime },
-        { L"--create",       OptionType::CreationTime },
-        { L"--creation",     OptionType::CreationTime },
-        { L"--help",         OptionType::Help },
-        { L"--modified",     OptionType::ModificationTime },
-        { L"--modify",       OptionType::ModificationTime },
-        { L"--modification", OptionType::ModificationTime },
-        { L"--now",          OptionType::Now },
-        { L"--time",         OptionType::Time },
-        { L"--timeZone",     OptionType::TimeZone },
-        { L"--version",      OptionType::Version },
-    };
+        if ((count == 0) || earlier (other.min, min)) min = other.min;
+        if ((count == 0) || earlier (max, other.max)) max = other.max;
 
-    for (auto option : optionStrings) {
-        if (equalIgnoreCase(arg, option.optString)) {
-            ++argi;
-            return option.type;
-        }
-    }
+        count          += other.count;
+        secondsSum     += other.secondsSum;
+        nanosecondsSum += other.nanosecondsSum;
+        zeroCount      += other.zeroCount;
 
-    // Single-dash options that may have (immediately-trailing) arguments.
-    if (arg[0] == L'-') switch (tolower(arg[1])) {
-        case L'%': optionType = OptionType::CodeChar;         break;
-        case L'a': optionType = OptionType::AccessTime;       break;
-        case L'c': optionType = OptionType::CreationTime;     break;
-        case L'h': optionType = OptionType::Help;             break;
-        case L'm': optionType = OptionType::ModificationTime; break;
-        case L't': optionType = OptionType::Time;             break;
-        case L'z': optionType = OptionType::TimeZone;         break;
+        for (int i = 0;  i < bucketCount;  ++i)
+            buckets[i] += other.buckets[i];
     }
 
-    // If we have a valid single-dash option and the parameter immediately follows, don't advance
+    Time mean () const {
+        // Returns the exact mean duration, truncated to the nanosecond.
+
+        auto seconds     = secondsSum / static_cast<int64_t>(count);
+        auto remainder   = secondsSum - seconds * static_cast<int64_t>(count);
+        auto nanoseconds = (remainder * nanosecondsPerSecond + nanosecondsSum) / static_cast<int64_t>(count);
+
+        return Time (seconds + nanoseconds / nanosecondsPerSecond,
+                     static_cast<int32_t>(nanoseconds % nanosecondsPerSecond));
+    }
+
+    Time quantile (double fraction) const {
+        // Returns the estimated duration at the given quantile, from 0 to 1.
+
+        auto rank  = static_cast<uint64_t>(fraction * (count - 1) + 0.5);     // Nearest rank
+        auto total = zeroCount;
+
+        if (rank < total)
+            return min;
+
+        for (int i = 0;  i < bucketCount;  ++i) {
+            total += buckets[i];
+            if (rank < total) {
+                // The bucket holds durations in (gamma^(i-1), gamma^i]. Its estimate is the point
+                // with equal relative error to either bound, clamped to the exact range.
+                auto estimate = 2 * pow (gamma, i) / (gamma + 1);
+                estimate = std::max (toNanoseconds (min), std::min (estimate, toNanoseconds (max)));
+                auto seconds = floor (estimate / nanosecondsPerSecond);
+                return Time (static_cast<int64_t>(seconds),
+                             static_cast<int32_t>(std::min (estimate - seconds * nanosecondsPerSecond, 999999999.0)));
+            }
+        }
+
+        return max;
+    }
+
+  private:
+    static constexpr double  relativeAccuracy = 0.01;
+    static constexpr double  gamma = (1 + relativeAccuracy) / (1 - relativeAccuracy);
+    static constexpr int     bucketCount = 2400;     // Covers durations beyond 20,000 years
+    static constexpr int64_t nanosecondsPerSecond = 1000000000;
+
+    const double     logGamma { log (gamma) };
+    int64_t          secondsSum     { 0 };
+    int64_t          nanosecondsSum { 0 };
+    uint64_t         zeroCount      { 0 };      // Durations under one nanosecond
+    vector<uint64_t> buckets = vector<uint64_t>(bucketCount, 0);
+
+    static double toNanoseconds (Time duration) {
+        return static_cast<double>(duration.seconds) * nanosecondsPerSecond + duration.nanoseconds;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+Time durationBetween (Time start, Time end) {
+    // Returns the non-negative difference between the two times.
+
+    auto seconds     = end.seconds - start.seconds;
+    auto nanoseconds = end.nanoseconds - start.nanoseconds;
+
+    if (nanoseconds < 0) {
+        nanoseconds += 1000000000;
+        --seconds;
+    }
+
+    if (seconds < 0) {
+        seconds = -seconds;
+        if (nanoseconds > 0) {
+            --seconds;
+            nanoseconds = 1000000000 - nanoseconds;
+        }
+    }
+
+    return Time (seconds, nanoseconds);
+}
+
+//__________________________________________________________________________________________________
+
+bool addDurations (
+    const BatchRun& run,        // Batch run state
+    const char*     begin,      // Start of input lines
+    const char*     end,        // End of input lines
+    DurationSketch& sketch)     // Accumulated durations
+{
+    // Adds the duration of each start and end time pair in the given block of input lines to the
+    // sketch. Empty lines are skipped. Returns true if all lines were processed successfully.
+
+    auto success = true;
+    auto isBlank = [](char c) { return (c == ' ') || (c == '\t'); };
+
+    while (begin < end) {
+        auto lineBegin = begin;
+        auto lineEnd   = std::find (begin, end, '\n');
+
+        begin = (lineEnd == end) ? end : std::next(lineEnd);
+
+        while ((lineEnd > lineBegin) && ((lineEnd[-1] == '\r') || isBlank (lineEnd[-1])))
+            --lineEnd;
+
+        if (lineBegin == lineEnd)
+            continue;
+
+        // Split the line into the start and end times.
+
+        auto startEnd  = std::find_if (lineBegin, lineEnd, isBlank);
+        auto timeBegin = std::find_if_not (startEnd, lineEnd, isBlank);
+
+        Time   startTime, endTime;
+        size_t errorIndex;
+
+        if (timeBegin == lineEnd) {
+            errorMsg (L"Expected start and end times: \"%.*S\"", static_cast<int>(lineEnd - lineBegin), lineBegin);
+            success = false;
+        } else if (!run.context.parse (lineBegin, startEnd, startTime, &errorIndex)) {
+            explicitTimeError (lineBegin, startEnd, errorIndex);
+            success = false;
+        } else if (!run.context.parse (timeBegin, lineEnd, endTime, &errorIndex)) {
+            explicitTimeError (timeBegin, lineEnd, errorIndex);
+            success = false;
+        } else {
+            sketch.add (durationBetween (startTime, endTime));
+        }
+    }
+
+    return success;
+}
+
+//__________________________________________________________________________________________________
+
+bool runStats (const Parameters& params, OutputBuffer& output) {
+    // Reads start and end time pairs from the standard input stream or the input file, and prints
+    // statistics of their durations. With multiple threads, each worker accumulates its own sketch,
+    // and the sketches are merged at the end. Returns true if all input lines were processed
+    // successfully.
+
+    BatchInput input (stdin, false);
+    BatchRun   run;
+
+    if (!startBatch (params, input, run))
+        return false;
+
+    vector<DurationSketch> sketches (params.threads);
+    auto success = true;
+
+    if (params.threads > 1) {
+        success = runBatchParallel (input, params.threads, [&](unsigned worker, BatchChunk& chunk) {
+            return addDurations (run, chunk.inputBegin(), chunk.inputEnd(), sketches[worker]);
+        }, output);
+    } else {
+        BatchChunk chunk;
+        while (input.next (chunk))
+            success = addDurations (run, chunk.inputBegin(), chunk.inputEnd(), sketches[0]) && success;
+    }
+
+    auto& total = sketches[0];
+    for (size_t i = 1;  i < sketches.size();  ++i)
+        total.merge (sketches[i]);
+
+    // Report the statistics, one per line.
+
+    output.text() += L"count " + std::to_wstring (total.count);
+    output.endLine();
+
+    if (total.count == 0)
+        return success;
+
+    struct {
+        const wchar_t* label;
+        Time           duration;
+    } results[] = {
+        { L"min   ", total.min },
+        { L"max   ", total.max },
+        { L"mean  ", total.mean() },
+        { L"p50   ", total.quantile (0.50) },
+        { L"p90   ", total.quantile (0.90) },
+        { L"p99   ", total.quantile (0.99) },
+        { L"p999  ", total.quantile (0.999) },
+    };
+
+    for (auto& result : results) {
+        output.put (result.label);
+        run.context.formatDelta (output.text(), run.format, Time(), result.duration);
+        output.endLine();
+    }
+
+    return success;
+}
+
+
+//======================================================================================================================
+// Timestamp Rewriting
+//======================================================================================================================
+
+// Rewritten timestamps are anchored on the `T` of an ISO 8601 date-time or the `@` of an epoch time.
+// Text is scanned for anchors a block at a time, and only the text around each anchor is examined.
+
+const ptrdiff_t maxTimestampLength = 64;    // Longest date-time token examined, in bytes
+
+inline bool isDigit (char c) {
+    return ('0' <= c) && (c <= '9');
+}
+
+inline bool isWordChar (char c) {
+    return isDigit(c) || (('A' <= c) && (c <= 'Z')) || (('a' <= c) && (c <= 'z')) || (c == '_');
+}
+
+inline bool isDateTimeChar (char c) {
+    // Characters that may continue the time part of a date-time: digits, separators and zones.
+    return isDigit(c) || (c == '-') || (c == ':') || (c == '.') || (c == ',') || (c == '+') || (c == 'Z');
+}
+
+//__________________________________________________________________________________________________
+
+const char* findTimestampAnchor (const char* begin, const char* end) {
+    // Returns the first `T` or `@` character in the given text, or the end if there is none. On x86
+    // and x64, sixteen bytes are compared at a time, so text with few anchors streams through at
+    // close to memory bandwidth.
+
+#if defined(_M_X64) || defined(_M_IX86)
+    const auto dateTimeAnchor = _mm_set1_epi8 ('T');
+    const auto epochAnchor    = _mm_set1_epi8 ('@');
+
+    for (;  end - begin >= 16;  begin += 16) {
+        auto block   = _mm_loadu_si128 (reinterpret_cast<const __m128i*>(begin));
+        auto matches = _mm_or_si128 (_mm_cmpeq_epi8 (block, dateTimeAnchor), _mm_cmpeq_epi8 (block, epochAnchor));
+        auto mask    = static_cast<unsigned long>(_mm_movemask_epi8 (matches));
+
+        if (mask) {
+            unsigned long index;
+            _BitScanForward (&index, mask);
+            return begin + index;
+        }
+    }
+#endif
+
+    while ((begin < end) && (*begin != 'T') && (*begin != '@'))
+        ++begin;
+
+    return begin;
+}
+
+//__________________________________________________________________________________________________
+
+bool parseEpochTime (const char*& it, const char* end, Time& result) {
+    // Parses an epoch time of the form `[-]<seconds>[.<fraction>]` at the given position, just past
+    // the `@`. Fraction digits past nanoseconds are ignored. On success, returns true with the
+    // iterator just past the epoch time.
+
+    auto p        = it;
+    auto negative = (p < end) && (*p == '-');
+    if (negative) ++p;
+
+    int64_t seconds = 0;
+    int     digits  = 0;
+
+    for (;  (p < end) && isDigit(*p);  ++p, ++digits) {
+        if (digits == 18) return false;
+        seconds = 10 * seconds + (*p - '0');
+    }
+
+    if (digits == 0) return false;
+
+    int32_t nanoseconds = 0;
+
+    if ((p + 1 < end) && (*p == '.') && isDigit(p[1])) {
+        int32_t scale = 100000000;
+        for (++p;  (p < end) && isDigit(*p);  ++p, scale /= 10)
+            nanoseconds += (*p - '0') * scale;
+    }
+
+    if (negative) {
+        seconds = -seconds;
+        if (nanoseconds) {
+            nanoseconds = 1000000000 - nanoseconds;
+            --seconds;
+        }
+    }
+
+    result = Time (seconds, nanoseconds);
+    it = p;
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+class TimestampRewriter {
+    // Copies text to a byte output buffer, replacing each embedded timestamp with its formatted
+    // value. Unchanged text is copied straight from the input, and formatted values are built in
+    // reused buffers, so there is no allocation per line or per timestamp.
+
+  public:
+    TimestampRewriter (const BatchRun& run, ByteOutputBuffer& output) : run(run), output(output) {}
+
+    void rewrite (const char* begin, const char* end) {
+        // Rewrites the given block of complete input lines, then flushes the output if the flush
+        // policy calls for it.
+
+        auto copied = begin;    // Start of the text not yet written
+        auto anchor = begin;
+
+        while ((anchor = findTimestampAnchor (anchor, end)) < end) {
+            const char* tokenBegin;
+            const char* tokenEnd;
+            Time        time;
+
+            auto found = (*anchor == '@')
+                       ? matchEpochTime (begin, anchor, end, tokenBegin, tokenEnd, time)
+                       : matchDateTime (begin, copied, anchor, end, tokenBegin, tokenEnd, time);
+
+            if (!found) {
+                ++anchor;
+                continue;
+            }
+
+            output.put (copied, tokenBegin - copied);
+            writeTime (time);
+            copied = anchor = tokenEnd;
+        }
+
+        output.put (copied, end - copied);
+        output.endLines();
+    }
+
+  private:
+    const BatchRun&   run;
+    ByteOutputBuffer& output;
+    wstring           text;     // Formatted timestamp
+    string            bytes;    // Formatted timestamp, as UTF-8
+
+    void writeTime (Time time) {
+        text.clear();
+
+        if (run.isDelta)
+            run.context.formatDelta (text, run.format, run.referenceTime, time);
+        else
+            run.context.formatCached (text, run.format, time);
+
+        toUTF8 (text.data(), text.length(), bytes);
+        output.put (bytes.data(), bytes.size());
+    }
+
+    static bool matchEpochTime (
+        const char*  blockBegin,    // Start of the input block
+        const char*  anchor,        // The `@` starting the epoch time
+        const char*  end,           // End of the input block
+        const char*& tokenBegin,    // Output start of the epoch time
+        const char*& tokenEnd,      // Output end of the epoch time
+        Time&        time)
+    {
+        // Matches an epoch time starting with the `@` at the anchor. The epoch time must not be
+        // part of a larger word, such as an email address.
+
+        if ((anchor > blockBegin) && isWordChar(anchor[-1]))
+            return false;
+
+        auto it = anchor + 1;
+        if (!parseEpochTime (it, end, time) || ((it < end) && isWordChar(*it)))
+            return false;
+
+        tokenBegin = anchor;
+        tokenEnd   = it;
+        return true;
+    }
+
+    bool matchDateTime (
+        const char*  blockBegin,    // Start of the input block
+        const char*  copied,        // Start of the text not yet written, the earliest token start
+        const char*  anchor,        // The `T` separating the date and time
+        const char*  end,           // End of the input block
+        const char*& tokenBegin,    // Output start of the date-time
+        const char*& tokenEnd,      // Output end of the date-time
+        Time&        time) const
+    {
+        // Matches a date-time around the `T` at the anchor, of the form `<date>T<time>`. The date
+        // extends back over digits and dashes, and the time forward over digits, separators and
+        // zone characters. Trailing punctuation that doesn't parse, such as a sentence period, is
+        // left out of the date-time.
+
+        if ((anchor == copied) || !isDigit(anchor[-1]) || (anchor + 1 == end) || !isDigit(anchor[1]))
+            return false;
+
+        auto first = anchor;
+        while ((first > copied) && (anchor - first < 12) && (isDigit(first[-1]) || (first[-1] == '-')))
+            --first;
+
+        if ((first[0] == '-') && (first[1] != '-'))     // A dash before the date isn't part of it.
+            ++first;
+
+        if ((first > blockBegin) && isWordChar(first[-1]))
+            return false;
+
+        auto last = anchor + 1;
+        while ((last < end) && (last - first < maxTimestampLength) && isDateTimeChar(*last))
+            ++last;
+
+        for (;  last > anchor + 1;  --last) {
+            if (run.context.parse (first, last, time)) {
+                if ((last < end) && isWordChar(*last))
+                    return false;
+
+                tokenBegin = first;
+                tokenEnd   = last;
+                return true;
+            }
+
+            if (isDigit(last[-1]) || (last[-1] == 'Z'))
+                return false;
+        }
+
+        return false;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+bool runRewrite (const Parameters& params) {
+    // Copies the standard input stream or the input file to the standard output stream, replacing
+    // each embedded timestamp with its formatted value. Input and output are handled as bytes, so
+    // that all other text, including line endings, is copied exactly. Returns true on success.
+
+    BatchInput input (stdin, true);
+    BatchRun   run;
+
+    _setmode (_fileno(stdin), _O_BINARY);
+
+    if (!startBatch (params, input, run))
+        return false;
+
+    _setmode (_fileno(stdout), _O_BINARY);
+
+    ByteOutputBuffer  output (stdout, params.flushPolicy, params.flushSize);
+    TimestampRewriter rewriter (run, output);
+    BatchChunk        chunk;
+
+    while (input.next (chunk))
+        rewriter.rewrite (chunk.inputBegin(), chunk.inputEnd());
+
+    return true;
+}
+
+
+//======================================================================================================================
+// Directory Tree Scanning
+//======================================================================================================================
+
+// Directories are scanned by a pool of workers, each with its own queue of directories. A worker
+// takes its most recently found directory first, which keeps its scan depth-first and local, and
+// when its queue is empty, steals the oldest directory from another worker's queue; older entries
+// are nearer the root, and so tend to hold the most remaining work. Each directory listing comes
+// with the times of all its entries, so no file is opened or queried on its own.
+
+wstring extendedPath (const wstring& path) {
+    // Returns the given path as an absolute extended-length (`\\?\`) path, so that directories
+    // nested beyond MAX_PATH can still be read. Returns the path unchanged if it can't be resolved.
+
+    auto length = GetFullPathNameW (path.c_str(), 0, nullptr, nullptr);
+    if (length == 0)
+        return path;
+
+    wstring fullPath (length, L'\0');
+    length = GetFullPathNameW (path.c_str(), length, &fullPath[0], nullptr);
+    if ((length == 0) || (length >= fullPath.length()))
+        return path;
+    fullPath.resize (length);
+
+    // Device and already extended paths are used as is, and UNC paths take the `\\?\UNC\` form.
+
+    if ((fullPath.compare (0, 4, L"\\\\?\\") == 0) || (fullPath.compare (0, 4, L"\\\\.\\") == 0))
+        return fullPath;
+
+    if (fullPath.compare (0, 2, L"\\\\") == 0)
+        return L"\\\\?\\UNC" + fullPath.substr (1);
+
+    return L"\\\\?\\" + fullPath;
+}
+
+//__________________________________________________________________________________________________
+
+class TreeScanner {
+  public:
+    TreeScanner (const Parameters& params, const BatchRun& run, OutputBuffer& output)
+      : run(run), output(output), queues(params.threads), timeType(params.treeTime)
+    {}
+
+    bool setFilter (const Parameters& params) {
+        // Sets the time range of reported files from the `--newer` and `--older` options. Returns
+        // false if either time is unrecognized.
+
+        TimeSpec spec;
+
+        if (!params.newerThan.empty()) {
+            spec.Set (TimeType::Explicit, params.newerThan);
+            if (!getTimeFromSpec (run.context, newerThan, spec))
+                return false;
+            hasNewerThan = true;
+        }
+
+        if (!params.olderThan.empty()) {
+            spec.Set (TimeType::Explicit, params.olderThan);
+            if (!getTimeFromSpec (run.context, olderThan, spec))
+                return false;
+            hasOlderThan = true;
+        }
+
+        return true;
+    }
+
+    bool scan (const wstring& root) {
+        // Reports the times of all files under the given root directory. The tree is read through
+        // the root's extended-length path, but reported paths begin with the root as given.
+        // Returns true if all directories were read successfully.
+
+        rootName = root;
+        rootPath = extendedPath (root);
+        pending  = 1;
+        queued   = 1;
+        queues[0].directories.push_back (rootPath);
+
+        if (queues.size() == 1) {
+            work (0);
+        } else {
+            vector<std::thread> workers;
+            for (unsigned i = 0;  i < queues.size();  ++i)
+                workers.emplace_back ([this, i]{ work (i); });
+            for (auto& worker : workers)
+                worker.join();
+        }
+
+        return success;
+    }
+
+  private:
+    class WorkQueue {
+      public:
+        std::mutex          mutex;
+        std::deque<wstring> directories;    // Directories found but not yet scanned
+    };
+
+    const BatchRun&         run;
+    OutputBuffer&           output;
+    std::mutex              outputMutex;
+    vector<WorkQueue>       queues;             // One work queue per worker
+    std::atomic<size_t>     pending { 0 };      // Directories queued or being scanned
+    std::atomic<size_t>     queued { 0 };       // Directories queued and not yet taken
+    std::mutex              waitMutex;          // Guards idle workers' checks of the counts above
+    std::condition_variable workReady;          // Signaled when directories are queued or the scan ends
+    std::atomic<bool>       success { true };
+    wstring                 rootName;           // Tree root as given
+    wstring                 rootPath;           // Tree root as read, in extended-length form
+    TimeType                timeType;           // Type of file time to report
+    bool                    hasNewerThan { false };
+    bool                    hasOlderThan { false };
+    Time                    newerThan;
+    Time                    olderThan;
+
+    static const size_t outputBlockSize = 64 * 1024;    // Worker output size, in characters
+
+    void work (unsigned worker) {
+        // Scans directories until the whole tree is done. Output is gathered per worker and
+        // handed to the shared output buffer in blocks of whole lines.
+
+        wstring directory;
+        wstring text;
+
+        while (takeWork (worker, directory)) {
+            scanDirectory (worker, directory, text);
+
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock (waitMutex);
+                workReady.notify_all();
+            }
+
+            if (text.length() >= outputBlockSize)
+                putOutput (text);
+        }
+
+        putOutput (text);
+    }
+
+    bool takeWork (unsigned worker, wstring& directory) {
+        // Takes the next directory to scan, from the end of the worker's own queue, or else from
+        // the front of another worker's queue. Sleeps while all queues are empty and other workers
+        // may still find more directories. Returns false when the scan is complete.
+
+        while (true) {
+            for (size_t i = 0;  i < queues.size();  ++i) {
+                auto& queue = queues[(worker + i) % queues.size()];
+                std::lock_guard<std::mutex> lock (queue.mutex);
+
+                if (queue.directories.empty())
+                    continue;
+
+                if (i == 0) {
+                    directory = std::move (queue.directories.back());
+                    queue.directories.pop_back();
+                } else {
+                    directory = std::move (queue.directories.front());
+                    queue.directories.pop_front();
+                }
+                --queued;
+                return true;
+            }
+
+            std::unique_lock<std::mutex> lock (waitMutex);
+            workReady.wait (lock, [this]{ return (queued > 0) || (pending == 0); });
+
+            if (pending == 0)
+                return false;
+        }
+    }
+
+    void scanDirectory (unsigned worker, const wstring& directory, wstring& text) {
+        // Reports each entry of the given directory, and queues its subdirectories for scanning.
+
+        auto separator = (!directory.empty() && (directory.back() == L'\\' || directory.back() == L'/'))
+                       ? L"" : L"\\";
+        auto prefix    = directory + separator;
+
+        WIN32_FIND_DATAW entry;
+        auto find = FindFirstFileExW ((prefix + L"*").c_str(), FindExInfoBasic, &entry, FindExSearchNameMatch,
+                                      nullptr, FIND_FIRST_EX_LARGE_FETCH);
+
+        if (find == INVALID_HANDLE_VALUE) {
+            errorMsg (L"Couldn't read directory \"%s\"", displayPath (directory).c_str());
+            success = false;
+            return;
+        }
+
+        vector<wstring> subdirectories;
+
+        do {
+            auto name = entry.cFileName;
+            if ((wcscmp (name, L".") == 0) || (wcscmp (name, L"..") == 0))
+                continue;
+
+            auto path = prefix + name;
+
+            auto isDirectory = (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            auto isLink      = (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+
+            report (path, entry, text);
+
+            if (isDirectory && !isLink)
+                subdirectories.push_back (std::move (path));
+
+        } while (FindNextFileW (find, &entry));
+
+        FindClose (find);
+
+        if (subdirectories.empty())
+            return;
+
+        pending += subdirectories.size();
+
+        {
+            auto& queue = queues[worker];
+            std::lock_guard<std::mutex> lock (queue.mutex);
+            for (auto& subdirectory : subdirectories)
+                queue.directories.push_back (std::move (subdirectory));
+            queued += subdirectories.size();
+        }
+
+        // Wake idle workers to steal the new directories. Taking the wait lock first ensures that no
+        // worker is between its check of the counts and its wait.
+
+        std::lock_guard<std::mutex> lock (waitMutex);
+        workReady.notify_all();
+    }
+
+    wstring displayPath (const wstring& path) const {
+        // Returns the given scanned path, starting with the tree root as given instead of as read.
+        return rootName + path.substr (rootPath.length());
+    }
+
+    void report (const wstring& path, const WIN32_FIND_DATAW& entry, wstring& text) {
+        // Appends the path and formatted time of a directory entry, unless its time is outside
+        // the filter range. Filtered entries are never formatted.
+
+        auto fileTime = timeFromFileTime (
+              (timeType == TimeType::Access)   ? entry.ftLastAccessTime
+            : (timeType == TimeType::Creation) ? entry.ftCreationTime
+            :                                    entry.ftLastWriteTime);
+
+        if (hasNewerThan && !earlier (newerThan, fileTime)) return;
+        if (hasOlderThan && !earlier (fileTime, olderThan)) return;
+
+        text.append (rootName).append (path, rootPath.length(), wstring::npos);
+        text += L'\t';
+
+        if (run.isDelta)
+            run.context.formatDelta (text, run.format, run.referenceTime, fileTime);
+        else
+            run.context.format (text, run.format, fileTime);
+
+        text += L'\n';
+    }
+
+    void putOutput (wstring& text) {
+        // Moves a worker's complete output lines to the shared output buffer.
+
+        if (text.empty()) return;
+
+        std::lock_guard<std::mutex> lock (outputMutex);
+        output.putLines (text);
+        text.clear();
+    }
+};
+
+//__________________________________________________________________________________________________
+
+bool runTree (const Parameters& params, OutputBuffer& output) {
+    // Reports the time of every file and directory under the tree root. Returns true if the whole
+    // tree was read successfully.
+
+    BatchRun run;
+
+    if (!startRun (params, run))
+        return false;
+
+    TreeScanner scanner (params, run, output);
+
+    if (!scanner.setFilter (params))
+        return false;
+
+    return scanner.scan (params.treeRoot);
+}
+
+
+//======================================================================================================================
+// Command-Option Processing
+//======================================================================================================================
+
+OptionType getOptionType (int& argi, int& paramOffset, wchar_t* argv[]) {
+    // This function returns the type of the current option (indexed by `argi`). The option
+    // parameter may immediately follow a single-letter option (for example, `-t12:00`). In this
+    // case, `paramOffset` will be 2 and `argi` will not change, otherwise `argi` will be
+    // incremented and `paramOffset` will be 0. Finally, the option type will be returned.
+    // Unrecognized options will return OptionType::None, `argi` will be left unchanged, and
+    // paramOffset will be 0.
+
+    auto arg = argv[argi];
+    paramOffset = 0;
+    auto optionType = OptionType::None;
+
+    // Check double-dash options and other options that take no arguments.
+
+    struct {
+        const wchar_t* optString;
+        OptionType     type;
+    } optionStrings[] = {
+        { L"/?",             OptionType::Help },
+        { L"-n",             OptionType::Now },
+        { L"--accessed",     OptionType::AccessTime },
+        { L"--access",       OptionType::AccessTime },
+        { L"--batch",        OptionType::Batch },
+        { L"--client",       OptionType::Client },
+        { L"--codeChar",     OptionType::CodeChar },
+        { L"--created",      OptionType::CreationTime },
+        { L"--create",       OptionType::CreationTime },
+        { L"--creation",     OptionType::CreationTime },
+        { L"--flush",        OptionType::Flush },
+        { L"--help",         OptionType::Help },
+        { L"--input",        OptionType::Input },
+        { L"--jobs",         OptionType::Jobs },
+        { L"--modified",     OptionType::ModificationTime },
+        { L"--modify",       OptionType::ModificationTime },
+        { L"--modification", OptionType::ModificationTime },
+        { L"--newer",        OptionType::Newer },
+        { L"--now",          OptionType::Now },
+        { L"--older",        OptionType::Older },
+        { L"--rewrite",      OptionType::Rewrite },
+        { L"--serve",        OptionType::Serve },
+        { L"--stats",        OptionType::Stats },
+        { L"--stdin",        OptionType::Batch },
+        { L"--threads",      OptionType::Threads },
+        { L"--time",         OptionType::Time },
+        { L"--timeZone",     OptionType::TimeZone },
+        { L"--tree",         OptionType::Tree },
+        { L"--treeTime",     OptionType::TreeTime },
+        { L"--version",      OptionType::Version },
+    };
+
+    for (auto option : optionStrings) {
+        if (equalIgnoreCase(arg, option.optString)) {
+            ++argi;
+            return option.type;
+        }
+    }
+
+    // Single-dash options that may have (immediately-trailing) arguments.
+    if (arg[0] == L'-') switch (tolower(arg[1])) {
+        case L'%': optionType = OptionType::CodeChar;         break;
+        case L'a': optionType = OptionType::AccessTime;       break;
+        case L'c': optionType = OptionType::CreationTime;     break;
+        case L'h': optionType = OptionType::Help;             break;
+        case L'm': optionType = OptionType::ModificationTime; break;
+        case L't': optionType = OptionType::Time;             break;
+        case L'z': optionType = OptionType::TimeZone;         break;
+    }
+
+    // If we have a valid single-dash option and the parameter immediately follows, don't advance
     // the argument index, and set the parameter offset. Otherwise, advance to the next argument.
     if (optionType != OptionType::None && arg[2] != 0)
         paramOffset = 2;
     else
         ++argi;
 
-    return optionType;
+    return optionType;
+}
+
+//__________________________________________________________________________________________________
+
+bool getFlushPolicy (Parameters& params, const wchar_t* policy) {
+    // Sets the output flush policy from the `--flush` option argument, which is either `line`,
+    // `exit`, or a flush size in kilobytes. Returns false if the argument is invalid.
+
+    if (equalIgnoreCase(policy, L"line")) {
+        params.flushPolicy = FlushPolicy::Line;
+        return true;
+    }
+
+    if (equalIgnoreCase(policy, L"exit")) {
+        params.flushPolicy = FlushPolicy::Exit;
+        return true;
+    }
+
+    wchar_t* end;
+    auto kilobytes = wcstoul (policy, &end, 10);
+    if (*end || kilobytes < 1)
+        return false;
+
+    params.flushPolicy = FlushPolicy::Size;
+    params.flushSize   = kilobytes * 1024;
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+bool getParameters (Parameters &params, int argc, wchar_t* argv[]) {
+    // This function processes the command line arguments and sets the corresponding values in the
+    // Parameters structure. This function returns true if all arguments were legal and processed
+    // properly, otherwise it returns false.
+
+    // Output to a console is written line by line, otherwise in large blocks.
+    params.flushPolicy = _isatty(_fileno(stdout)) ? FlushPolicy::Line : FlushPolicy::Size;
+
+    // Process command arguments.
+    auto argi = 1;
+    while (argi < argc) {
+
+        int paramOffset;
+        auto arg = argv[argi];
+        auto priorArgi = argi;         // Used later for reporting on invalid third time values.
+
+        auto optionType = getOptionType(argi, paramOffset, argv);
+
+        // Non-option arguments accrue to the output format string.
+        if (optionType == OptionType::None) {
+            if (!params.format.empty())
+                params.format += L" ";
+            params.format += arg;
+            continue;
+        }
+
+        TimeSpec newTimeSpec;
+
+        if (optionType == OptionType::Now) {
+            newTimeSpec.Set(TimeType::Now);
+        } else if (optionType == OptionType::Batch) {
+            params.isBatch = true;
+        } else if (optionType == OptionType::Rewrite) {
+            params.isRewrite = true;
+            params.isBatch = true;
+        } else if (optionType == OptionType::Stats) {
+            params.isStats = true;
+            params.isBatch = true;
+        } else if (optionType == OptionType::Version) {
+            params.helpType = HelpType::Version;
+            return true;
+        } else {
+
+            wchar_t* parameter = (argi >= argc) ? nullptr : (argv[argi] + paramOffset);
+
+            if (optionType == OptionType::Help) {
+                // The help option may or may not take a parameter.
+                params.helpType = (parameter == nullptr)                     ? HelpType::General
+                                : equalIgnoreCase(parameter, L"examples")    ? HelpType::Examples
+                                : equalIgnoreCase(parameter, L"delta")       ? HelpType::DeltaTime
+                                : equalIgnoreCase(parameter, L"deltaTime")   ? HelpType::DeltaTime
+                                : equalIgnoreCase(parameter, L"deltaTimes")  ? HelpType::DeltaTime
+                                : equalIgnoreCase(parameter, L"format")      ? HelpType::FormatCodes
+                                : equalIgnoreCase(parameter, L"formatCode")  ? HelpType::FormatCodes
+                                : equalIgnoreCase(parameter, L"formatCodes") ? HelpType::FormatCodes
+                                : equalIgnoreCase(parameter, L"timeSyntax")  ? HelpType::TimeSyntax
+                                : equalIgnoreCase(parameter, L"timeZone")    ? HelpType::TimeZone
+                                : equalIgnoreCase(parameter, L"timeZones")   ? HelpType::TimeZone
+                                : equalIgnoreCase(parameter, L"full")        ? HelpType::Full
+                                : HelpType::General;
+                return true;
+            } else {
+                // Options that always take parameters.
+
+                if (optionType == OptionType::AccessTime) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    newTimeSpec.Set(TimeType::Access, parameter);
+
+                } else if (optionType == OptionType::CodeChar) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.codeChar = *parameter;
+
+                } else if (optionType == OptionType::CreationTime) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    newTimeSpec.Set(TimeType::Creation, parameter);
+
+                } else if (optionType == OptionType::ModificationTime) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    newTimeSpec.Set(TimeType::Modification, parameter);
+
+                } else if (optionType == OptionType::Time) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    newTimeSpec.Set(TimeType::Explicit, parameter);
+
+                } else if (optionType == OptionType::TimeZone) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.zone = parameter;
+
+                } else if (optionType == OptionType::Flush) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    if (!getFlushPolicy (params, parameter))
+                        return errorMsg(L"Invalid flush policy (%s)", parameter);
+
+                } else if (optionType == OptionType::Input) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.inputFile = parameter;
+                    params.isBatch = true;
+
+                } else if (optionType == OptionType::Jobs) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.jobsFile = parameter;
+
+                } else if (optionType == OptionType::Serve) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.serveSocket = parameter;
+
+                } else if (optionType == OptionType::Client) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.clientSocket = parameter;
+
+                } else if (optionType == OptionType::Threads) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    // Counts are limited to a few threads per processor, so that a stray large
+                    // count (or a negative one, which wcstoul() would wrap) can't exhaust memory.
+                    auto processors = std::max (1u, std::thread::hardware_concurrency());
+                    auto maxThreads = std::max (64u, 4 * processors);
+                    wchar_t* end;
+                    auto count = wcstoul (parameter, &end, 10);
+                    if (!iswdigit (*parameter) || *end || (count > maxThreads))
+                        return errorMsg(L"Invalid thread count (%s)", parameter);
+                    params.threads = (count == 0) ? processors : static_cast<unsigned>(count);
+
+                } else if (optionType == OptionType::Tree) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.treeRoot = parameter;
+
+                } else if (optionType == OptionType::TreeTime) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.treeTime = equalIgnoreCase(parameter, L"access")       ? TimeType::Access
+                                    : equalIgnoreCase(parameter, L"accessed")     ? TimeType::Access
+                                    : equalIgnoreCase(parameter, L"create")       ? TimeType::Creation
+                                    : equalIgnoreCase(parameter, L"created")      ? TimeType::Creation
+                                    : equalIgnoreCase(parameter, L"creation")     ? TimeType::Creation
+                                    : equalIgnoreCase(parameter, L"modify")       ? TimeType::Modification
+                                    : equalIgnoreCase(parameter, L"modified")     ? TimeType::Modification
+                                    : equalIgnoreCase(parameter, L"modification") ? TimeType::Modification
+                                    : TimeType::None;
+                    if (params.treeTime == TimeType::None)
+                        return errorMsg(L"Invalid tree time type (%s)", parameter);
+
+                } else if (optionType == OptionType::Newer) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.newerThan = parameter;
+
+                } else if (optionType == OptionType::Older) {
+                    if (!parameter)
+                        return errorMsg(L"Missing argument for %s option", arg);
+                    params.olderThan = parameter;
+                }
+
+                ++argi;
+            }
+        }
+
+        // Add in new (first or second) time spec.
+        if (newTimeSpec.type != TimeType::None) {
+            if (params.time1.type == TimeType::None) {
+                params.time1 = newTimeSpec;
+            } else if (params.time2.type == TimeType::None) {
+                params.time2 = newTimeSpec;
+                params.isDelta = true;
+            } else {
+                auto twoArgs = optionType != OptionType::Now;
+                return errorMsg (L"Unexpected third time value (%s%s%s)",
+                    argv[priorArgi], twoArgs ? L" " : L"", twoArgs ? argv[priorArgi+1] : L"");
+            }
+        }
+    }
+
+    if (params.isStats) {
+        // Statistics mode takes both times of each duration from its input.
+        if (params.time1.type != TimeType::None)
+            return errorMsg (L"Statistics mode takes no time values");
+    } else if (params.isBatch || !params.treeRoot.empty()) {
+        // In batch and tree modes, input times are either reported directly, or compared against a
+        // single reference time given on the command line.
+        if (params.isDelta)
+            return errorMsg (L"Batch mode takes at most one time value");
+        params.isDelta = (params.time1.type != TimeType::None);
+    } else if (params.time1.type == TimeType::None) {
+        // If no time source was specified, then report information for the current time.
+        params.time1.Set(TimeType::Now);
+    }
+
+    if (params.treeRoot.empty()
+        && ((params.treeTime != TimeType::None) || !params.newerThan.empty() || !params.olderThan.empty()))
+        return errorMsg (L"The --treeTime, --newer and --older options require --tree");
+
+    // If no format string was specified on the command line, use the default time format.
+    if (params.format.empty()) {
+        params.format = defaultTimeFormat (params.isDelta || params.isStats);
+        params.codeChar = L'%';
+    }
+
+    return true;
+}
+
+
+//======================================================================================================================
+// Command Execution
+//======================================================================================================================
+
+// Job files and the server run full command lines in process, sharing the contexts and compiled
+// formats they use across commands.
+
+static const size_t maxCacheSize = 256;     // Most contexts or formats held in a command cache
+
+class CommandCache {
+    // Contexts and compiled formats kept across commands. Each cache is simply cleared when it grows
+    // past the maximum cache size.
+
+  public:
+    Context* context (const wstring& zone) {
+        // Returns the context for the given time zone, or null if the zone is not recognized. An
+        // empty zone selects the default zone.
+
+        auto entry = contexts.find (zone);
+        if (entry != contexts.end())
+            return &entry->second;
+
+        Context context;
+        if (!zone.empty() && !context.setTimeZone (zone))
+            return nullptr;
+
+        if (contexts.size() >= maxCacheSize)
+            contexts.clear();
+
+        return &contexts.emplace (zone, std::move(context)).first->second;
+    }
+
+    const Format& format (const wstring& formatString, wchar_t codeChar) {
+        auto key = std::make_pair (formatString, codeChar);
+
+        auto entry = formats.find (key);
+        if (entry != formats.end())
+            return entry->second;
+
+        if (formats.size() >= maxCacheSize)
+            formats.clear();
+
+        return formats.emplace (key, Format (formatString, codeChar)).first->second;
+    }
+
+  private:
+    std::map<wstring, Context>                         contexts;
+    std::map<std::pair<wstring, wchar_t>, Format>      formats;
+};
+
+//__________________________________________________________________________________________________
+
+void resolveFileName (TimeSpec& spec, const wstring& directory) {
+    // Makes a relative file name in a file time specification relative to the given directory.
+
+    auto isFileTime = (spec.type == TimeType::Access)
+                   || (spec.type == TimeType::Creation)
+                   || (spec.type == TimeType::Modification);
+
+    if (!isFileTime || directory.empty() || spec.value.empty())
+        return;
+
+    auto& name = spec.value;
+    auto isAbsolute = (name[0] == L'\\') || (name[0] == L'/') || (name.length() > 1 && name[1] == L':');
+
+    if (!isAbsolute)
+        name = directory + L'\\' + name;
+}
+
+//__________________________________________________________________________________________________
+
+int runCommand (
+    CommandCache&     cache,        // Shared contexts and formats
+    vector<wstring>&  args,         // Command-line arguments, without the program name
+    const wstring&    directory,    // Directory for relative file names, or empty for the current one
+    const wstring&    defaultZone,  // Time zone to use if none is given, or empty for the default
+    wstring&          output)       // Output results
+{
+    // Computes the results for one command line, in the same way as a direct run of the program.
+    // Returns the exit code for the command.
+
+    wstring          programName = L"timeprint";
+    vector<wchar_t*> argv { programName.data() };
+
+    for (auto& arg : args)
+        argv.push_back (arg.data());
+
+    Parameters params;
+
+    if (!getParameters (params, static_cast<int>(argv.size()), argv.data()))
+        return -1;
+
+    // Each job yields exactly one result line, so only the single-line version text is available.
+    if (params.helpType == HelpType::Version) {
+        output = helpText (params.helpType);
+        return 0;
+    }
+
+    if (params.helpType != HelpType::None) {
+        errorMsg (L"Help is not available for a job or server request");
+        return -1;
+    }
+
+    if (!params.serveSocket.empty() || !params.clientSocket.empty() || !params.jobsFile.empty()) {
+        errorMsg (L"The --jobs, --serve and --client options can't be nested");
+        return -1;
+    }
+
+    if (params.isBatch || !params.treeRoot.empty()) {
+        errorMsg (L"Batch and tree modes are not available for a job or server request");
+        return -1;
+    }
+
+    resolveFileName (params.time1, directory);
+    resolveFileName (params.time2, directory);
+
+    // An explicit time zone must be recognized. Otherwise use the default zone if it's recognized,
+    // falling back to the system zone as a direct run would.
+
+    auto context = cache.context (params.zone.empty() ? defaultZone : params.zone);
+
+    if (!context) {
+        if (!params.zone.empty()) {
+            errorMsg (L"Unrecognized time zone (%s)", params.zone.c_str());
+            return 1;
+        }
+        context = cache.context (L"");
+    }
+
+    context->snapshotTime();
+
+    Time time1;
+    Time time2;
+
+    if (!getTimeFromSpec (*context, time1, params.time1)) return 1;
+    if (params.isDelta && !getTimeFromSpec (*context, time2, params.time2)) return 1;
+
+    auto& format = cache.format (params.format, params.codeChar);
+
+    if (params.isDelta)
+        context->formatDelta (output, format, time1, time2);
+    else
+        context->format (output, format, time1);
+
+    output += L'\n';
+    return 0;
+}
+
+//__________________________________________________________________________________________________
+
+vector<wstring> splitCommandLine (const wstring& line) {
+    // Splits a command line into arguments, separated by spaces or tabs. Double quotes group text
+    // that contains spaces, and a backslash-escaped double quote is taken literally.
+
+    vector<wstring> args;
+    wstring         arg;
+    bool            inArg   = false;
+    bool            inQuote = false;
+
+    for (size_t i = 0;  i < line.length();  ++i) {
+        auto c = line[i];
+
+        if (!inQuote && (c == L' ' || c == L'\t')) {
+            if (inArg)
+                args.push_back (arg);
+            arg.clear();
+            inArg = false;
+        } else if (c == L'\\' && i + 1 < line.length() && line[i+1] == L'"') {
+            arg += L'"';
+            inArg = true;
+            ++i;
+        } else if (c == L'"') {
+            inQuote = !inQuote;
+            inArg = true;
+        } else {
+            arg += c;
+            inArg = true;
+        }
+    }
+
+    if (inArg)
+        args.push_back (arg);
+
+    return args;
+}
+
+//__________________________________________________________________________________________________
+
+bool readLine (FILE* stream, string& line) {
+    // Reads the next line from the stream, without its line ending. Returns false at end of input.
+
+    char buffer [4096];
+
+    line.clear();
+
+    while (fgets (buffer, sizeof buffer, stream)) {
+        line += buffer;
+        if (line.back() == '\n')
+            break;
+    }
+
+    if (line.empty())
+        return false;
+
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        line.pop_back();
+
+    return true;
 }
 
 //__________________________________________________________________________________________________
 
-bool getParameters (Parameters &params, int argc, wchar_t* argv[]) {
-    // This function processes the command line arguments and sets the corresponding values in the
-    // Parameters structure. This function returns true if all arguments were legal and processed
-    // properly, otherwise it returns false.
+bool runJobs (const Parameters& params, OutputBuffer& output) {
+    // Runs each line of the job file (or the standard input stream) as a complete command line.
+    // Jobs read from the standard input stream have their results written as soon as each job
+    // completes. Returns true if all jobs succeeded.
 
-    // Process command arguments.
-    auto argi = 1;
-    while (argi < argc) {
+    FILE* stream = stdin;
+    auto  isStdin = (params.jobsFile == L"-");
 
-        int paramOffset;
-        auto arg = argv[argi];
-        auto priorArgi = argi;         // Used later for reporting on invalid third time values.
+    if (!isStdin && (0 != _wfopen_s (&stream, params.jobsFile.c_str(), L"rb")))
+        return errorMsg (L"Couldn't open job file \"%s\"", params.jobsFile.c_str());
 
-        auto optionType = getOptionType(argi, paramOffset, argv);
+    CommandCache cache;
+    string       line;
+    wstring      result;
+    auto         success = true;
 
-        // Non-option arguments accrue to the output format string.
-        if (optionType == OptionType::None) {
-            if (!params.format.empty())
-                params.format += L" ";
-            params.format += arg;
-            continue;
+    while (readLine (stream, line)) {
+        auto args = splitCommandLine (fromUTF8 (line.data(), line.length()));
+
+        result.clear();
+        if (0 != runCommand (cache, args, L"", L"", result)) {
+            success = false;
+            result = L"\n";
         }
 
-        TimeSpec newTimeSpec;
+        output.putLines (result);
+        if (isStdin)
+            output.flush();
+    }
 
-        if (optionType == OptionType::Now) {
-            newTimeSpec.Set(TimeType::Now);
-        } else if (optionType == OptionType::Version) {
-            params.helpType = HelpType::Version;
-            return true;
-        } else {
+    if (!isStdin)
+        fclose (stream);
 
-            wchar_t* parameter = (argi >= argc) ? nullptr : (argv[argi] + paramOffset);
+    return success;
+}
 
-            if (optionType == OptionType::Help) {
-                // The help option may or may not take a parameter.
-                params.helpType = (parameter == nullptr)                     ? HelpType::General
-                                : equalIgnoreCase(parameter, L"examples")    ? HelpType::Examples
-                                : equalIgnoreCase(parameter, L"delta")       ? HelpType::DeltaTime
-                                : equalIgnoreCase(parameter, L"deltaTime")   ? HelpType::DeltaTime
-                                : equalIgnoreCase(parameter, L"deltaTimes")  ? HelpType::DeltaTime
-                                : equalIgnoreCase(parameter, L"format")      ? HelpType::FormatCodes
-                                : equalIgnoreCase(parameter, L"formatCode")  ? HelpType::FormatCodes
-                                : equalIgnoreCase(parameter, L"formatCodes") ? HelpType::FormatCodes
-                                : equalIgnoreCase(parameter, L"timeSyntax")  ? HelpType::TimeSyntax
-                                : equalIgnoreCase(parameter, L"timeZone")    ? HelpType::TimeZone
-                                : equalIgnoreCase(parameter, L"timeZones")   ? HelpType::TimeZone
-                                : equalIgnoreCase(parameter, L"full")        ? HelpType::Full
-                                : HelpType::General;
-                return true;
-            } else {
-                // Options that always take parameters.
 
-                if (optionType == OptionType::AccessTime) {
-                    if (!parameter)
-                        return errorMsg(L"Missing argument for %s option", arg);
-                    newTimeSpec.Set(TimeType::Access, parameter);
+//======================================================================================================================
+// Server and Client Modes
+//======================================================================================================================
 
-                } else if (optionType == OptionType::CodeChar) {
-                    if (!parameter)
-                        return errorMsg(L"Missing argument for %s option", arg);
-                    params.codeChar = *parameter;
+// A server and its clients exchange length-prefixed frames over a Unix domain socket, one request
+// and one response per connection. All integers are 32-bit little-endian values, and all strings
+// are UTF-8, preceded by their length in bytes.
+//
+//     Request:   <frame size> <string count> <directory> <TZ> <TimeFormat> <TimeFormat_Delta>
+//                <argument> ... <argument>
+//     Response:  <frame size> <exit code> <output text> <error text>
+//
+// The request carries the client's current directory (for relative file names) and its time zone
+// and default format environment variables, so that results match a direct run of the client.
 
-                } else if (optionType == OptionType::CreationTime) {
-                    if (!parameter)
-                        return errorMsg(L"Missing argument for %s option", arg);
-                    newTimeSpec.Set(TimeType::Creation, parameter);
+static const uint32_t maxFrameSize  = 1 << 20;    // Largest frame accepted from a peer
+static const DWORD    socketTimeout = 5000;       // Milliseconds to wait on a stalled peer
+static const unsigned serverThreads = 8;          // Threads serving client connections
 
-                } else if (optionType == OptionType::ModificationTime) {
-                    if (!parameter)
-                        return errorMsg(L"Missing argument for %s option", arg);
-                    newTimeSpec.Set(TimeType::Modification, parameter);
+static const wchar_t* requestEnvironment[] = { L"TZ", L"TimeFormat", L"TimeFormat_Delta" };
 
-                } else if (optionType == OptionType::Time) {
-                    if (!parameter)
-                        return errorMsg(L"Missing argument for %s option", arg);
-                    newTimeSpec.Set(TimeType::Explicit, parameter);
+#ifndef IO_REPARSE_TAG_AF_UNIX
+    #define IO_REPARSE_TAG_AF_UNIX 0x80000023L    // Reparse tag of socket files, missing from older SDKs
+#endif
 
-                } else if (optionType == OptionType::TimeZone) {
-                    if (!parameter)
-                        return errorMsg(L"Missing argument for %s option", arg);
-                    params.zone = parameter;
-                }
+//__________________________________________________________________________________________________
 
-                ++argi;
-            }
+class FrameWriter {
+    // Builds the body of an outgoing frame.
+
+  public:
+    string body;
+
+    void putUint32 (uint32_t value) {
+        for (int i = 0;  i < 4;  ++i)
+            body += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+
+    void putString (const wstring& text) {
+        auto utf8 = toUTF8 (text);
+        putUint32 (static_cast<uint32_t>(utf8.length()));
+        body += utf8;
+    }
+};
+
+//__________________________________________________________________________________________________
+
+class FrameReader {
+    // Reads values from the body of an incoming frame. Each get function returns false if the
+    // frame is too short to hold the value.
+
+  public:
+    FrameReader (const string& body) : next(body.data()), end(body.data() + body.length()) {}
+
+    bool getUint32 (uint32_t& value) {
+        if (end - next < 4) return false;
+
+        value = 0;
+        for (int i = 0;  i < 4;  ++i)
+            value |= uint32_t(static_cast<unsigned char>(*next++)) << (8 * i);
+
+        return true;
+    }
+
+    bool getString (wstring& text) {
+        uint32_t length;
+        if (!getUint32 (length) || uint32_t(end - next) < length) return false;
+
+        text = fromUTF8 (next, length);
+        next += length;
+        return true;
+    }
+
+  private:
+    const char* next;   // Next unread byte
+    const char* end;    // End of the frame body
+};
+
+//__________________________________________________________________________________________________
+
+bool sendFrame (SOCKET socket, const FrameWriter& frame) {
+    // Sends the frame size followed by the frame body. Returns false if the connection fails.
+
+    FrameWriter header;
+    header.putUint32 (static_cast<uint32_t>(frame.body.length()));
+
+    const string* parts[] = { &header.body, &frame.body };
+
+    for (auto part : parts) {
+        auto data = part->data();
+        auto remaining = static_cast<int>(part->length());
+
+        while (remaining > 0) {
+            auto sent = send (socket, data, remaining, 0);
+            if (sent <= 0) return false;
+            data += sent;
+            remaining -= sent;
         }
+    }
 
-        // Add in new (first or second) time spec.
-        if (newTimeSpec.type != TimeType::None) {
-            if (params.time1.type == TimeType::None) {
-                params.time1 = newTimeSpec;
-            } else if (params.time2.type == TimeType::None) {
-                params.time2 = newTimeSpec;
-                params.isDelta = true;
-            } else {
-                auto twoArgs = optionType != OptionType::Now;
-                return errorMsg (L"Unexpected third time value (%s%s%s)",
-                    argv[priorArgi], twoArgs ? L" " : L"", twoArgs ? argv[priorArgi+1] : L"");
-            }
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+bool receiveFrame (SOCKET socket, string& body) {
+    // Receives a complete frame body. Returns false if the connection fails or closes early, or if
+    // the frame exceeds the maximum frame size.
+
+    auto receiveAll = [socket](char* data, int size) {
+        while (size > 0) {
+            auto received = recv (socket, data, size, 0);
+            if (received <= 0) return false;
+            data += received;
+            size -= received;
         }
+        return true;
+    };
+
+    string header (4, '\0');
+    uint32_t size;
+
+    if (!receiveAll (header.data(), 4) || !FrameReader(header).getUint32 (size) || size > maxFrameSize)
+        return false;
+
+    body.assign (size, '\0');
+    return receiveAll (body.data(), static_cast<int>(size));
+}
+
+//__________________________________________________________________________________________________
+
+bool socketAddress (const wstring& socketPath, sockaddr_un& address) {
+    // Fills in the socket address for the given socket file path. Returns false if the path is too
+    // long for a socket address.
+
+    auto path = toUTF8 (socketPath);
+
+    address = sockaddr_un();
+    address.sun_family = AF_UNIX;
+
+    if (path.empty() || path.length() >= sizeof address.sun_path)
+        return errorMsg (L"Invalid socket path (%s)", socketPath.c_str());
+
+    memcpy (address.sun_path, path.data(), path.length());
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+bool startSockets () {
+    WSADATA wsaData;
+
+    if (0 != WSAStartup (MAKEWORD(2,2), &wsaData))
+        return errorMsg (L"Couldn't initialize Windows sockets");
+
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+bool serverRunning (const sockaddr_un& address) {
+    // Returns true if a server already answers on the given socket address.
+
+    auto probe = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (probe == INVALID_SOCKET)
+        return false;
+
+    auto connected = (SOCKET_ERROR != connect (probe, reinterpret_cast<const sockaddr*>(&address), sizeof address));
+    closesocket (probe);
+    return connected;
+}
+
+//__________________________________________________________________________________________________
+
+bool removeStaleSocket (const wstring& socketPath) {
+    // Removes a socket file left behind by an earlier server. Returns false if the path names any
+    // other kind of file, which is left alone. Returns true if nothing exists at the path.
+
+    auto file = CreateFileW (socketPath.c_str(), FILE_READ_ATTRIBUTES,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                             FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return true;    // Nothing to remove; any other problem with the path is reported by bind.
+
+    FILE_ATTRIBUTE_TAG_INFO info;
+    auto isSocket = GetFileInformationByHandleEx (file, FileAttributeTagInfo, &info, sizeof info)
+                 && (info.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+                 && (info.ReparseTag == IO_REPARSE_TAG_AF_UNIX);
+
+    CloseHandle (file);
+
+    if (!isSocket)
+        return errorMsg (L"Socket path \"%s\" names an existing file that isn't a socket", socketPath.c_str());
+
+    DeleteFileW (socketPath.c_str());
+    return true;
+}
+
+//__________________________________________________________________________________________________
+
+void serveClient (CommandCache& cache, std::mutex& cacheMutex, SOCKET client) {
+    // Reads one request from the client connection, and sends back the results. Malformed requests
+    // are dropped without a response. Socket reads and writes run concurrently with other clients;
+    // only the command itself, which uses the shared cache, runs under the cache mutex.
+
+    string   body;
+    uint32_t count;
+
+    if (!receiveFrame (client, body))
+        return;
+
+    FrameReader reader (body);
+    vector<wstring> request;
+
+    if (!reader.getUint32 (count) || count < 1 + std::size(requestEnvironment))
+        return;
+
+    request.resize (count);
+    for (auto& item : request) {
+        if (!reader.getString (item))
+            return;
     }
 
-    // If no time source was specified, then report information for the current time.
-    if (params.time1.type == TimeType::None)
-        params.time1.Set(TimeType::Now);
+    std::map<wstring, wstring> environment;
+    for (size_t i = 0;  i < std::size(requestEnvironment);  ++i) {
+        if (!request[1 + i].empty())
+            environment[requestEnvironment[i]] = request[1 + i];
+    }
 
-    // If no format string was specified on the command line, use the default time format.
-    if (params.format.empty()) {
-        params.format = defaultTimeFormat (params.isDelta);
-        params.codeChar = L'%';
+    wstring output;
+    wstring errors;
+
+    errorCapture = &errors;
+    environmentOverride = &environment;
+
+    vector<wstring> args (request.begin() + 1 + std::size(requestEnvironment), request.end());
+
+    int exitCode;
+    {
+        std::lock_guard<std::mutex> lock (cacheMutex);
+        exitCode = runCommand (cache, args, request[0], request[1], output);
     }
 
-    return true;
+    errorCapture = nullptr;
+    environmentOverride = nullptr;
+
+    FrameWriter response;
+    response.putUint32 (static_cast<uint32_t>(exitCode));
+    response.putString (output);
+    response.putString (errors);
+
+    sendFrame (client, response);
+}
+
+//__________________________________________________________________________________________________
+
+bool runServer (const wstring& socketPath) {
+    // Serves client requests on the given socket until the process is killed. Accepted connections
+    // are handed to a small pool of threads, so a client that stalls while sending its request
+    // holds up only its own thread, not every other client. Returns false only if the server can't
+    // be started.
+
+    sockaddr_un address;
+
+    if (!startSockets() || !socketAddress (socketPath, address))
+        return false;
+
+    // Never take over from a server that is still running on the socket.
+
+    if (serverRunning (address))
+        return errorMsg (L"A server is already running on socket \"%s\"", socketPath.c_str());
+
+    if (!removeStaleSocket (socketPath))
+        return false;
+
+    auto listener = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET)
+        return errorMsg (L"Couldn't create server socket");
+
+    if (  SOCKET_ERROR == bind (listener, reinterpret_cast<const sockaddr*>(&address), sizeof address)
+       || SOCKET_ERROR == listen (listener, SOMAXCONN)) {
+        closesocket (listener);
+        return errorMsg (L"Couldn't listen on socket \"%s\"", socketPath.c_str());
+    }
+
+    CommandCache            cache;
+    std::mutex              cacheMutex;     // Guards the cache, for one command at a time
+    std::mutex              queueMutex;     // Guards the accepted client queue
+    std::condition_variable clientReady;    // Signaled when a client is queued
+    std::deque<SOCKET>      clients;        // Accepted clients waiting for a thread
+
+    // The server runs until killed, so the pool threads never outlive this function's state.
+
+    for (unsigned i = 0;  i < serverThreads;  ++i) {
+        std::thread ([&]{
+            while (true) {
+                SOCKET client;
+                {
+                    std::unique_lock<std::mutex> lock (queueMutex);
+                    clientReady.wait (lock, [&]{ return !clients.empty(); });
+                    client = clients.front();
+                    clients.pop_front();
+                }
+
+                serveClient (cache, cacheMutex, client);
+                closesocket (client);
+            }
+        }).detach();
+    }
+
+    while (true) {
+        auto client = accept (listener, nullptr, nullptr);
+        if (client == INVALID_SOCKET)
+            continue;
+
+        auto timeout = reinterpret_cast<const char*>(&socketTimeout);
+        setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, timeout, sizeof socketTimeout);
+        setsockopt (client, SOL_SOCKET, SO_SNDTIMEO, timeout, sizeof socketTimeout);
+
+        std::lock_guard<std::mutex> lock (queueMutex);
+        clients.push_back (client);
+        clientReady.notify_one();
+    }
+}
+
+//__________________________________________________________________________________________________
+
+int runClient (const wstring& socketPath, int argc, wchar_t* argv[]) {
+    // Forwards this command's arguments, minus the --client option, to the server on the given
+    // socket. Prints the server's output and errors, and returns its exit code.
+
+    sockaddr_un address;
+
+    if (!startSockets() || !socketAddress (socketPath, address))
+        return 1;
+
+    // The server resolves file names against the client's current directory, so send it whole,
+    // however long.
+
+    wstring directory (GetCurrentDirectoryW (0, nullptr), L'\0');
+    auto directoryLength = directory.empty()
+                         ? 0 : GetCurrentDirectoryW (static_cast<DWORD>(directory.length()), &directory[0]);
+
+    if ((directoryLength == 0) || (directoryLength >= directory.length())) {
+        errorMsg (L"Couldn't get the current directory");
+        return 1;
+    }
+
+    directory.resize (directoryLength);
+
+    vector<wstring> request;
+    request.push_back (std::move (directory));
+
+    for (auto name : requestEnvironment)
+        request.push_back (environmentValue (name));
+
+    for (int argi = 1;  argi < argc;  ++argi) {
+        if (equalIgnoreCase (argv[argi], L"--client"))
+            ++argi;
+        else
+            request.emplace_back (argv[argi]);
+    }
+
+    FrameWriter frame;
+    frame.putUint32 (static_cast<uint32_t>(request.size()));
+    for (auto& item : request)
+        frame.putString (item);
+
+    auto server = socket (AF_UNIX, SOCK_STREAM, 0);
+
+    if (  server == INVALID_SOCKET
+       || SOCKET_ERROR == connect (server, reinterpret_cast<const sockaddr*>(&address), sizeof address)) {
+        if (server != INVALID_SOCKET)
+            closesocket (server);
+        errorMsg (L"Couldn't connect to server (%s)", socketPath.c_str());
+        return 1;
+    }
+
+    string   body;
+    uint32_t exitCode;
+    wstring  output;
+    wstring  errors;
+
+    auto received = sendFrame (server, frame) && receiveFrame (server, body);
+    closesocket (server);
+
+    FrameReader reader (body);
+
+    if (!received || !reader.getUint32 (exitCode) || !reader.getString (output) || !reader.getString (errors)) {
+        errorMsg (L"No response from server (%s)", socketPath.c_str());
+        return 1;
+    }
+
+    writeText (stdout, output);
+    writeText (stderr, errors);
+
+    return static_cast<int>(exitCode);
 }
 
 
@@ -1499,15 +3262,56 @@ bool getParameters (Parameters &params, int argc, wchar_t* argv[]) {
 int wmain (int argc, wchar_t *argv[]) {
     Parameters params;
 
+#if defined(TIMEPRINT_UTF8)
+    // Redirected output goes to UTF-8 pipelines and files. Console output is still converted by
+    // the C runtime, so that the console's code page is left alone.
+    utf8Output = !_isatty(_fileno(stdout));
+#endif
+
     if (!getParameters(params, argc, argv)) return -1;
 
-    help (params.helpType);
+    if (params.helpType != HelpType::None) {
+        writeText (stdout, helpText (params.helpType));
+        return 0;
+    }
+
+    if (!params.clientSocket.empty())
+        return runClient (params.clientSocket, argc, argv);
+
+    if (!params.serveSocket.empty())
+        return runServer (params.serveSocket) ? 0 : 1;
+
+    // Rewrite mode writes bytes through its own output buffer.
+    if (params.isRewrite)
+        return runRewrite (params) ? 0 : 1;
+
+    OutputBuffer output (stdout, params.flushPolicy, params.flushSize);
+
+    if (!params.jobsFile.empty())
+        return runJobs (params, output) ? 0 : 1;
+
+    if (params.isStats)
+        return runStats (params, output) ? 0 : 1;
+
+    if (!params.treeRoot.empty())
+        return runTree (params, output) ? 0 : 1;
+
+    if (params.isBatch)
+        return runBatch(params, output) ? 0 : 1;
+
+    Context context;
+    Time    time1;
+    Time    time2;
+
+    if (calcTime (context, params, time1, time2)) {
+        Format format (params.format, params.codeChar);
 
-    tm     calculatedTime;
-    time_t deltaTimeSeconds;
+        if (params.isDelta)
+            context.formatDelta (output.text(), format, time1, time2);
+        else
+            context.format (output.text(), format, time1);
 
-    if (calcTime (params, calculatedTime, deltaTimeSeconds)) {
-        printResults (params.format, params.codeChar, calculatedTime, deltaTimeSeconds);
+        output.endLine();
         return 0;
     }
 
@@ -0,0 +1,152 @@
+/*******************************************************************************
+The timeprint library parses, computes and formats time values. It is the
+engine behind the timeprint command-line tool, and may be embedded directly in
+other programs. See timeprint_c.h for the C interface.
+*******************************************************************************/
+
+#pragma once
+
+#include "timeprint_c.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace timeprint {
+
+class FormatPlan;
+class TimeContext;
+
+//__________________________________________________________________________________________________
+
+class Time {
+    // A point in time, in seconds and nanoseconds since 1970-01-01T00:00:00Z. The nanoseconds are
+    // always in the range [0, 1e9), so times before the epoch have a negative seconds count and a
+    // non-negative nanoseconds count.
+
+  public:
+    int64_t seconds     { 0 };
+    int32_t nanoseconds { 0 };
+
+    Time () = default;
+    Time (int64_t seconds, int32_t nanoseconds = 0) : seconds(seconds), nanoseconds(nanoseconds) {}
+};
+
+//__________________________________________________________________________________________________
+
+class TimeFields {
+    // A time broken down into calendar fields, in some time zone.
+
+  public:
+    int            year       { 1970 };
+    int            month      { 1 };        // Month of the year, 1 through 12
+    int            day        { 1 };        // Day of the month, 1 through 31
+    int            hour       { 0 };
+    int            minute     { 0 };
+    int            second     { 0 };
+    int32_t        nanosecond { 0 };
+    int            weekday    { 4 };        // Days since Sunday, 0 through 6
+    int            yearDay    { 0 };        // Days since January 1, 0 through 365
+    int            utcOffset  { 0 };        // Seconds east of UTC
+    const wchar_t* zoneName   { L"UTC" };   // Zone abbreviation, valid until the zone is changed
+};
+
+// Returns the calendar fields of the given time in UTC.
+TIMEPRINT_API TimeFields utcFields (Time time);
+
+// Formats times in bulk as fixed-width ASCII records "YYYY-MM-DDTHH:MM:SS+hhmm", at a fixed offset
+// from UTC in seconds east. Records are isoBatchLength characters each, written back to back with
+// no separators or terminating zero. Uses AVX2 or SSE4.1 when available. Returns the number of
+// times formatted; see timeprint_format_iso_batch().
+const size_t isoBatchLength = TIMEPRINT_ISO_BATCH_LENGTH;
+
+TIMEPRINT_API size_t formatISOBatch (const int64_t* times, size_t count, int utcOffset, char* output);
+
+//__________________________________________________________________________________________________
+
+class TIMEPRINT_API Format {
+    // A compiled format string. Formats are immutable, and may be shared by any number of contexts
+    // and threads.
+
+  public:
+    Format ();
+    Format (const std::wstring& format, wchar_t codeChar = L'%');
+
+  private:
+    // Shared-library builds export this class with a standard library member, which MSVC warns
+    // about (C4251). Clients must build with the same compiler and runtime as the library; the C
+    // interface in timeprint_c.h is the stable ABI.
+#if defined(_MSC_VER)
+    #pragma warning(push)
+    #pragma warning(disable: 4251)
+#endif
+    std::shared_ptr<const FormatPlan> plan;
+#if defined(_MSC_VER)
+    #pragma warning(pop)
+#endif
+
+    friend class Context;
+};
+
+//__________________________________________________________________________________________________
+
+class TIMEPRINT_API Context {
+    // A time conversion context, holding a time zone and a snapshot of the current time. Explicit
+    // time fields that are not given take their values from the current time snapshot. A context
+    // may be used by any number of threads at once, and different contexts are fully independent.
+    // Times have nanosecond resolution; see Time.
+
+  public:
+    Context ();     // Uses the zone in the TZ environment variable, or the system local time zone,
+                    // loaded on first use unless another zone is set first
+    ~Context ();
+
+    Context (Context&&) noexcept;
+    Context& operator= (Context&&) noexcept;
+
+    // Sets the time zone, either a zoneinfo name such as "America/Los_Angeles", or a POSIX TZ
+    // rule such as "PST8PDT". An empty zone selects the default zone. Returns false if the zone is
+    // not recognized, leaving the context unchanged. Also updates the current time snapshot.
+    bool setTimeZone (const std::wstring& zone);
+
+    void    snapshotTime ();            // Updates the current time snapshot
+    Time    currentTime () const;       // Returns the current time snapshot
+
+    // Parses an ISO 8601 explicit time, with optional fractional seconds. On failure, returns false
+    // and sets errorIndex (if given) to the index of the first unrecognized character.
+    bool parse (const wchar_t* begin, const wchar_t* end, Time& result, size_t* errorIndex = nullptr) const;
+    bool parse (const char* begin, const char* end, Time& result, size_t* errorIndex = nullptr) const;
+
+    // Appends the formatted time, or the formatted difference between two times, to the output.
+    void format (std::wstring& output, const Format& format, Time time) const;
+    void formatDelta (std::wstring& output, const Format& format, Time time1, Time time2) const;
+
+    // Writes the formatted time or time difference to the given buffer, in the style of snprintf().
+    // At most bufferSize characters are written, including the terminating zero. Returns the
+    // length of the full formatted string, excluding the terminating zero.
+    size_t format (wchar_t* buffer, size_t bufferSize, const Format& format, Time time) const;
+    size_t formatDelta (wchar_t* buffer, size_t bufferSize, const Format& format, Time time1, Time time2) const;
+
+    // Formats the time as format() does, for high-volume timestamping such as logging. Each thread
+    // caches the output most recently rendered for each of a few formats and zones. A time in the
+    // same second as the cached output costs only a copy and patching the fractional seconds.
+    void formatCached (std::wstring& output, const Format& format, Time time) const;
+    size_t formatCached (wchar_t* buffer, size_t bufferSize, const Format& format, Time time) const;
+
+    // Returns the calendar fields of the given time in the context's time zone.
+    TimeFields fields (Time time) const;
+
+  private:
+#if defined(_MSC_VER)
+    #pragma warning(push)
+    #pragma warning(disable: 4251)     // Standard library member of an exported class; see Format
+#endif
+    std::unique_ptr<TimeContext> state;
+#if defined(_MSC_VER)
+    #pragma warning(pop)
+#endif
+
+    const TimeContext& ready () const;      // Returns the state, loading the default zone if needed
+};
+
+}
@@ -0,0 +1,444 @@
+﻿/*******************************************************************************
+This program measures the speed of the timeprint library's hot paths: explicit
+time parsing, time calculation, and time and delta formatting. Each benchmark
+is run in a number of timed samples, and reported in nanoseconds per operation.
+Formatted output goes to a reused string that is discarded, so no I/O is timed.
+
+With --startup, it instead measures the wall time of complete runs of a given
+command line, from process creation to exit, in microseconds.
+
+With --check, it instead checks the compile-time formats against known results,
+including years before 0, and exits with status 1 on any mismatch.
+*******************************************************************************/
+
+#include "timeprint.h"
+#include "timeprint_static.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using std::wstring;
+
+using timeprint::Context;
+using timeprint::Format;
+using timeprint::Time;
+
+using Clock = std::chrono::steady_clock;
+
+
+static const wchar_t* usage =
+    L"usage: timeprint_bench [--samples <count>] [--timezone <zone>] [<name filter>]\n"
+    L"       timeprint_bench [--samples <count>] --startup \"<command line>\"\n"
+    L"       timeprint_bench --check\n";
+
+static const int      defaultSampleCount = 200;
+static const int64_t  minSampleNanoseconds = 200'000;     // Calibrated duration of each sample
+static const int      startupWarmupRuns = 5;              // Untimed runs to warm the file cache
+
+// Results of each operation are folded into this value, so the compiler can't discard the work.
+static volatile size_t sink;
+
+// Compile-time formats, matching run-time formats benchmarked below
+static constexpr auto staticStampFormat = timeprint::staticFormat (L"%F %T.%6N");
+static constexpr auto staticDeltaFormat = timeprint::staticFormat (L"%_Y years, %_yD days, %_d0H:%_h0M:%_m0S");
+
+// Compile-time format checked by --check, covering the century and year of century codes
+static constexpr auto staticCheckFormat = timeprint::staticFormat (L"%C %y %D %F %T");
+
+
+//======================================================================================================================
+// Benchmark Harness
+//======================================================================================================================
+
+class BenchResult {
+  public:
+    int    iterations {0};    // Operations per sample
+    double mean {0};          // Nanoseconds per operation
+    double p50 {0};
+    double p90 {0};
+    double p99 {0};
+    double min {0};
+};
+
+//__________________________________________________________________________________________________
+
+double percentile (const vector<double>& sorted, double fraction) {
+    // Returns the nearest-rank percentile of the given sorted samples.
+
+    auto index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min (index, sorted.size() - 1)];
+}
+
+//__________________________________________________________________________________________________
+
+int64_t timeIterations (const std::function<size_t()>& operation, int iterations) {
+    // Runs the operation the given number of times, and returns the elapsed time in nanoseconds.
+
+    size_t total = 0;
+    auto   start = Clock::now();
+
+    for (int i = 0;  i < iterations;  ++i)
+        total += operation();
+
+    auto stop = Clock::now();
+    sink = sink + total;
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+}
+
+//__________________________________________________________________________________________________
+
+BenchResult runBenchmark (const std::function<size_t()>& operation, int sampleCount) {
+    // Calibrates the number of iterations per sample so that each sample is long enough to time
+    // reliably, then runs the samples and gathers statistics on the per-operation times.
+
+    BenchResult result;
+
+    // Warm up caches, then double the iteration count until a sample takes long enough.
+
+    timeIterations (operation, 100);
+
+    int iterations = 1;
+    while (timeIterations (operation, iterations) < minSampleNanoseconds && iterations < (1 << 24))
+        iterations *= 2;
+
+    vector<double> samples;
+    samples.reserve (sampleCount);
+
+    double total = 0;
+    for (int i = 0;  i < sampleCount;  ++i) {
+        auto nsPerOp = static_cast<double>(timeIterations (operation, iterations)) / iterations;
+        samples.push_back (nsPerOp);
+        total += nsPerOp;
+    }
+
+    std::sort (samples.begin(), samples.end());
+
+    result.iterations = iterations;
+    result.mean = total / sampleCount;
+    result.min  = samples.front();
+    result.p50  = percentile (samples, 0.50);
+    result.p90  = percentile (samples, 0.90);
+    result.p99  = percentile (samples, 0.99);
+
+    return result;
+}
+
+
+//======================================================================================================================
+// Startup Benchmark
+//======================================================================================================================
+
+double timeProcess (const wstring& commandLine, HANDLE nullDevice) {
+    // Runs the command line to completion with its standard streams on the null device, and returns
+    // the wall time from process creation to exit in microseconds, or a negative value if the
+    // process can't be started.
+
+    STARTUPINFOW startup {};
+    startup.cb         = sizeof startup;
+    startup.dwFlags    = STARTF_USESTDHANDLES;
+    startup.hStdInput  = nullDevice;
+    startup.hStdOutput = nullDevice;
+    startup.hStdError  = nullDevice;
+
+    PROCESS_INFORMATION process;
+    wstring command = commandLine;      // CreateProcessW() may modify the command line.
+
+    auto start = Clock::now();
+
+    if (!CreateProcessW (nullptr, command.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process))
+        return -1;
+
+    WaitForSingleObject (process.hProcess, INFINITE);
+    auto stop = Clock::now();
+
+    CloseHandle (process.hThread);
+    CloseHandle (process.hProcess);
+
+    return std::chrono::duration<double, std::micro>(stop - start).count();
+}
+
+//__________________________________________________________________________________________________
+
+int runStartupBenchmark (const wstring& commandLine, int sampleCount) {
+    // Times complete runs of the command line, and reports statistics on the run times.
+
+    SECURITY_ATTRIBUTES inheritable { sizeof inheritable, nullptr, TRUE };
+
+    auto nullDevice = CreateFileW (L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                   &inheritable, OPEN_EXISTING, 0, nullptr);
+
+    for (int i = 0;  i < startupWarmupRuns;  ++i) {
+        if (timeProcess (commandLine, nullDevice) < 0) {
+            fwprintf (stderr, L"timeprint_bench: Couldn't run \"%s\".\n", commandLine.c_str());
+            return 1;
+        }
+    }
+
+    vector<double> samples;
+    samples.reserve (sampleCount);
+
+    double total = 0;
+    for (int i = 0;  i < sampleCount;  ++i) {
+        auto microseconds = timeProcess (commandLine, nullDevice);
+        samples.push_back (microseconds);
+        total += microseconds;
+    }
+
+    CloseHandle (nullDevice);
+    std::sort (samples.begin(), samples.end());
+
+    wprintf (L"%-28s %10s %10s %10s %10s %10s %10s\n",
+        L"startup (us)", L"runs", L"min", L"p50", L"p90", L"p99", L"mean");
+
+    wprintf (L"%-28s %10d %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+        commandLine.c_str(), sampleCount, samples.front(), percentile (samples, 0.50),
+        percentile (samples, 0.90), percentile (samples, 0.99), total / sampleCount);
+
+    return 0;
+}
+
+
+//======================================================================================================================
+// Static Format Check
+//======================================================================================================================
+
+int runCheck () {
+    // Renders UTC times with the static check format and compares each with its known result. The
+    // century and year of century of years before 0 follow the run-time formatter: the century is
+    // rounded toward negative infinity, and the year of century is never negative.
+
+    struct {
+        int64_t        seconds;
+        const wchar_t* expected;
+    } cases[] = {
+        {   1714979289, L"20 24 05/06/24 2024-05-06 07:08:09" },
+        {            0, L"19 70 01/01/70 1970-01-01 00:00:00" },
+        { -62187929511, L"-1 99 05/06/99 -1-05-06 07:08:09"   },
+        { -89800246311, L"-9 24 05/06/24 -876-05-06 07:08:09" },
+    };
+
+    Context context;
+    context.setTimeZone (L"UTC");
+
+    int     failures = 0;
+    wstring output;
+
+    for (auto& test : cases) {
+        output.clear();
+        timeprint::formatTime<staticCheckFormat> (output, context, Time (test.seconds, 0));
+
+        if (output != test.expected) {
+            fwprintf (stderr, L"timeprint_bench: Static format of %lld gave \"%s\", expected \"%s\".\n",
+                static_cast<long long>(test.seconds), output.c_str(), test.expected);
+            ++failures;
+        }
+    }
+
+    wprintf (L"Static format check: %d of %d cases passed.\n",
+        static_cast<int>(std::size(cases)) - failures, static_cast<int>(std::size(cases)));
+
+    return (failures == 0) ? 0 : 1;
+}
+
+
+//======================================================================================================================
+// Main Entry Function
+//======================================================================================================================
+
+int wmain (int argc, wchar_t *argv[]) {
+    int     sampleCount = defaultSampleCount;
+    wstring zoneName = L"PST8PDT";
+    wstring filter;
+    wstring startupCommand;
+
+    for (int argi = 1;  argi < argc;  ++argi) {
+        if (0 == wcscmp (argv[argi], L"--samples") && argi + 1 < argc) {
+            sampleCount = std::max (1, _wtoi (argv[++argi]));
+        } else if (0 == wcscmp (argv[argi], L"--check")) {
+            return runCheck();
+        } else if (0 == wcscmp (argv[argi], L"--startup") && argi + 1 < argc) {
+            startupCommand = argv[++argi];
+        } else if (0 == wcscmp (argv[argi], L"--timezone") && argi + 1 < argc) {
+            zoneName = argv[++argi];
+        } else if (argv[argi][0] == L'-') {
+            fputws (usage, stderr);
+            return 1;
+        } else {
+            filter = argv[argi];
+        }
+    }
+
+    if (!startupCommand.empty())
+        return runStartupBenchmark (startupCommand, sampleCount);
+
+    Context context;
+    if (!context.setTimeZone (zoneName)) {
+        fwprintf (stderr, L"timeprint_bench: Unrecognized time zone (%s).\n", zoneName.c_str());
+        return 1;
+    }
+
+    // Benchmark inputs
+
+    const string  narrowTime     = "2019-03-14T15:09:26";
+    const string  narrowTimeUTC  = "2019-03-14T15:09:26Z";
+    const wstring wideTime       = L"2019-03-14T15:09:26-0700";
+    const wstring wideTime2      = L"2021-11-07T01:30:00";
+
+    const wchar_t* formatStrings[] = { L"%#c", L"%i", L"%F %T", L"%a %d %b %Y %I %p" };
+    const wchar_t* deltaFormatString = L"%_Y years, %_yD days, %_d0H:%_h0M:%_m0S";
+
+    Time time1, time2;
+    context.parse (wideTime.data(), wideTime.data() + wideTime.size(), time1);
+    context.parse (wideTime2.data(), wideTime2.data() + wideTime2.size(), time2);
+
+    wstring output;     // Reused output string, discarded after each operation
+
+    // Benchmark table
+
+    struct Benchmark {
+        wstring                  name;
+        std::function<size_t()>  operation;
+        int                      items {1};     // Items processed per operation, for per-item times
+    };
+
+    vector<Benchmark> benchmarks;
+
+    benchmarks.push_back ({ L"parse narrow local", [&]() -> size_t {
+        Time result;
+        context.parse (narrowTime.data(), narrowTime.data() + narrowTime.size(), result);
+        return static_cast<size_t>(result.seconds);
+    }});
+
+    benchmarks.push_back ({ L"parse narrow UTC", [&]() -> size_t {
+        Time result;
+        context.parse (narrowTimeUTC.data(), narrowTimeUTC.data() + narrowTimeUTC.size(), result);
+        return static_cast<size_t>(result.seconds);
+    }});
+
+    benchmarks.push_back ({ L"parse wide offset", [&]() -> size_t {
+        Time result;
+        context.parse (wideTime.data(), wideTime.data() + wideTime.size(), result);
+        return static_cast<size_t>(result.seconds);
+    }});
+
+    benchmarks.push_back ({ L"calc delta of two times", [&]() -> size_t {
+        // The command-line calculation of a delta time: parse both times, then take the difference.
+        Time a, b;
+        context.parse (wideTime.data(), wideTime.data() + wideTime.size(), a);
+        context.parse (wideTime2.data(), wideTime2.data() + wideTime2.size(), b);
+        return static_cast<size_t>(b.seconds - a.seconds);
+    }});
+
+    benchmarks.push_back ({ L"compile default delta", [&]() -> size_t {
+        Format format (deltaFormatString);
+        return sizeof format;
+    }});
+
+    vector<Format> formats;
+    for (auto formatString : formatStrings)
+        formats.emplace_back (formatString);
+
+    for (size_t i = 0;  i < formats.size();  ++i) {
+        auto& format = formats[i];
+        benchmarks.push_back ({ wstring(L"format ") + formatStrings[i], [&]() -> size_t {
+            output.clear();
+            context.format (output, format, time1);
+            return output.size();
+        }});
+    }
+
+    // Logger-style timestamps: successive times a microsecond apart, so nearly all fall in the same
+    // second as the previous call.
+
+    Format  stampFormat (L"%F %T.%6N");
+    int32_t stampMicroseconds = 0;
+
+    auto nextStamp = [&]() {
+        stampMicroseconds = (stampMicroseconds + 1) % 1000000;
+        return Time (time1.seconds, stampMicroseconds * 1000);
+    };
+
+    benchmarks.push_back ({ L"format timestamp", [&]() -> size_t {
+        output.clear();
+        context.format (output, stampFormat, nextStamp());
+        return output.size();
+    }});
+
+    benchmarks.push_back ({ L"format timestamp cached", [&]() -> size_t {
+        output.clear();
+        context.formatCached (output, stampFormat, nextStamp());
+        return output.size();
+    }});
+
+    benchmarks.push_back ({ L"format timestamp static", [&]() -> size_t {
+        output.clear();
+        timeprint::formatTime<staticStampFormat> (output, context, nextStamp());
+        return output.size();
+    }});
+
+    Format deltaFormat (deltaFormatString);
+
+    benchmarks.push_back ({ L"format default delta", [&]() -> size_t {
+        output.clear();
+        context.formatDelta (output, deltaFormat, time1, time2);
+        return output.size();
+    }});
+
+    benchmarks.push_back ({ L"format default delta static", [&]() -> size_t {
+        output.clear();
+        timeprint::formatDelta<staticDeltaFormat> (output, time1, time2);
+        return output.size();
+    }});
+
+    // Batch ISO formatting of successive log times, reported per time for comparison with
+    // "format %i".
+
+    const int isoBatchSize = 1024;
+
+    vector<int64_t> isoTimes (isoBatchSize);
+    for (int i = 0;  i < isoBatchSize;  ++i)
+        isoTimes[i] = time1.seconds + i * 37;
+
+    vector<char> isoOutput (isoBatchSize * timeprint::isoBatchLength);
+
+    benchmarks.push_back ({ L"format ISO batch", [&]() -> size_t {
+        return timeprint::formatISOBatch (isoTimes.data(), isoTimes.size(), -8 * 3600, isoOutput.data());
+    }, isoBatchSize });
+
+    // Run and report
+
+    wprintf (L"%-28s %10s %10s %10s %10s %10s %10s\n",
+        L"benchmark (ns/op)", L"iters", L"min", L"p50", L"p90", L"p99", L"mean");
+
+    for (auto& benchmark : benchmarks) {
+        if (!filter.empty() && benchmark.name.find (filter) == wstring::npos)
+            continue;
+
+        auto result = runBenchmark (benchmark.operation, sampleCount);
+
+        for (auto value : { &result.min, &result.p50, &result.p90, &result.p99, &result.mean })
+            *value /= benchmark.items;
+
+        wprintf (L"%-28s %10d %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            benchmark.name.c_str(), result.iterations,
+            result.min, result.p50, result.p90, result.p99, result.mean);
+        fflush (stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+C interface to the timeprint library. This interface has a stable C ABI, for
+use from C or from other languages through a foreign function interface. All
+strings are wide-character strings, and formatted output is written to
+caller-provided buffers in the style of snprintf().
+*******************************************************************************/
+
+#ifndef TIMEPRINT_C_H
+#define TIMEPRINT_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// When building or using timeprint as a shared library, define TIMEPRINT_SHARED. The library
+// itself is built with TIMEPRINT_BUILDING defined.
+
+#if defined(TIMEPRINT_SHARED)
+    #if defined(TIMEPRINT_BUILDING)
+        #define TIMEPRINT_API __declspec(dllexport)
+    #else
+        #define TIMEPRINT_API __declspec(dllimport)
+    #endif
+#else
+    #define TIMEPRINT_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct timeprint_context timeprint_context;     // Time zone and current time
+typedef struct timeprint_format  timeprint_format;      // Compiled format string
+
+typedef struct timeprint_time {     // Time with nanosecond resolution
+    int64_t seconds;                // Seconds since 1970-01-01T00:00:00Z
+    int32_t nanoseconds;            // Nanoseconds past the second, 0 through 999,999,999
+} timeprint_time;
+
+// Creates a conversion context for the given time zone, with a snapshot of the current time. A null
+// or empty zone selects the zone given by the TZ environment variable, or the system local time
+// zone. Returns null if the time zone is not recognized.
+TIMEPRINT_API timeprint_context* timeprint_context_create (const wchar_t* zone);
+
+TIMEPRINT_API void timeprint_context_destroy (timeprint_context* context);
+
+// Returns the context's snapshot of the current time, in seconds since 1970-01-01T00:00:00Z.
+TIMEPRINT_API int64_t timeprint_current_time (const timeprint_context* context);
+
+// Returns the context's snapshot of the current time, with nanosecond resolution.
+TIMEPRINT_API timeprint_time timeprint_current_time_ns (const timeprint_context* context);
+
+// Compiles the given format string, with the given format code character (normally '%'). Returns
+// null on allocation failure.
+TIMEPRINT_API timeprint_format* timeprint_format_create (const wchar_t* format, wchar_t codeChar);
+
+TIMEPRINT_API void timeprint_format_destroy (timeprint_format* format);
+
+// Parses the ISO 8601 explicit time in the given string of the given length. Returns 1 on success,
+// with the time in seconds since 1970-01-01T00:00:00Z. Returns 0 on failure, with the index of the
+// first unrecognized character in errorIndex (which may be null).
+TIMEPRINT_API int timeprint_parse (
+    const timeprint_context* context, const char* text, size_t length, int64_t* result, size_t* errorIndex);
+
+TIMEPRINT_API int timeprint_parse_wide (
+    const timeprint_context* context, const wchar_t* text, size_t length, int64_t* result, size_t* errorIndex);
+
+// Parses an explicit time as for timeprint_parse(), keeping any fractional seconds.
+TIMEPRINT_API int timeprint_parse_ns (
+    const timeprint_context* context, const char* text, size_t length, timeprint_time* result, size_t* errorIndex);
+
+TIMEPRINT_API int timeprint_parse_wide_ns (
+    const timeprint_context* context, const wchar_t* text, size_t length, timeprint_time* result,
+    size_t* errorIndex);
+
+// Formats the given time (in seconds since 1970-01-01T00:00:00Z) in the context's time zone. At most
+// bufferSize characters are written, including the terminating zero. Returns the length of the full
+// formatted string, excluding the terminating zero; if this is not less than bufferSize, then the
+// output was truncated.
+TIMEPRINT_API size_t timeprint_format_time (
+    const timeprint_context* context, const timeprint_format* format, int64_t time,
+    wchar_t* buffer, size_t bufferSize);
+
+// Formats the difference between the two given times, as for timeprint_format_time().
+TIMEPRINT_API size_t timeprint_format_delta (
+    const timeprint_context* context, const timeprint_format* format, int64_t time1, int64_t time2,
+    wchar_t* buffer, size_t bufferSize);
+
+// Formats a time or time difference as above, with nanosecond resolution.
+TIMEPRINT_API size_t timeprint_format_time_ns (
+    const timeprint_context* context, const timeprint_format* format, timeprint_time time,
+    wchar_t* buffer, size_t bufferSize);
+
+TIMEPRINT_API size_t timeprint_format_delta_ns (
+    const timeprint_context* context, const timeprint_format* format, timeprint_time time1,
+    timeprint_time time2, wchar_t* buffer, size_t bufferSize);
+
+// Formats a time as for timeprint_format_time_ns(), reusing output cached per thread for times in
+// the same second. This is much faster for high-volume timestamping such as logging.
+TIMEPRINT_API size_t timeprint_format_time_cached (
+    const timeprint_context* context, const timeprint_format* format, timeprint_time time,
+    wchar_t* buffer, size_t bufferSize);
+
+// Formats each of the given times (in seconds since 1970-01-01T00:00:00Z) at the given offset from
+// UTC (in seconds east), as a fixed-width ASCII record "YYYY-MM-DDTHH:MM:SS+hhmm". Records are
+// TIMEPRINT_ISO_BATCH_LENGTH characters each, written back to back with no separators or
+// terminating zero. Returns the number of times formatted, which stops short of count at the first
+// time whose local year is outside 0000 through 9999. Returns 0 if the offset is a day or more.
+#define TIMEPRINT_ISO_BATCH_LENGTH 24
+
+TIMEPRINT_API size_t timeprint_format_iso_batch (
+    const int64_t* times, size_t count, int32_t utcOffset, char* output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,636 @@
+/*******************************************************************************
+Compile-time format strings for the timeprint library. A format string literal
+is parsed and validated at compile time into a static format, and each use is
+rendered by code specialized for that format, with no format interpretation
+at run time:
+
+    static constexpr auto isoFormat = timeprint::staticFormat (L"%FT%T%z");
+
+    std::wstring output;
+    timeprint::formatTime<isoFormat> (output, context, time);
+
+Malformed format codes are compile errors. Static formats support the numeric
+date and time codes, zone codes, fractional seconds and delta time codes. The
+locale-dependent codes (names, %c, %x, %X, %p and so on) and week-based codes
+are rejected; use timeprint::Format for those.
+*******************************************************************************/
+
+#pragma once
+
+#include "timeprint.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <string>
+#include <utility>
+
+namespace timeprint {
+
+enum class StaticOpType {
+    // Types of operations in a static format
+
+    Literal,        // Run of literal characters
+    Year,           // %Y
+    Century,        // %C
+    YearOfCentury,  // %y
+    Month,          // %m
+    Day,            // %d
+    DaySpace,       // %e, space padded
+    Hour,           // %H
+    Hour12,         // %I
+    Minute,         // %M
+    Second,         // %S
+    YearDay,        // %j
+    WeekdayMonday,  // %u, 1 (Monday) through 7
+    WeekdaySunday,  // %w, 0 (Sunday) through 6
+    Date,           // %F, %Y-%m-%d
+    Time,           // %T, %H:%M:%S
+    HourMinute,     // %R, %H:%M
+    DateUS,         // %D, %m/%d/%y
+    DateTime,       // %i, %Y-%m-%dT%H:%M:%S followed by the zone offset
+    ZoneOffset,     // %z
+    ZoneName,       // %Z
+    Fraction,       // %N, %<d>N
+    Delta,          // %_...
+};
+
+class StaticOp {
+  public:
+    StaticOpType type   { StaticOpType::Literal };
+    size_t       index  { 0 };  // Literal: offset into format text; Delta: index into deltas
+    size_t       length { 0 };  // Literal: number of characters; Fraction: digits
+};
+
+class StaticDelta {
+    // A delta time format, of the form `%_['kd][u[0]]<U>[.[#]]`. Unit sizes are in nanoseconds.
+
+  public:
+    wchar_t thousandsChar { 0 };    // Thousands-separator character, 0=none
+    wchar_t decimalChar   { L'.' }; // Decimal character
+    int64_t moduloSeconds { 0 };    // Seconds per next greater unit, 0=none
+    int64_t unitValue     { 1 };    // Nanoseconds per delta unit
+    int     leadingZeros  { 0 };    // Zero-padded field width, 0=none
+    int     precision     { 0 };    // Output decimal precision, 0=whole value
+};
+
+//__________________________________________________________________________________________________
+
+template <size_t N>
+class StaticFormat {
+    // A format string parsed at compile time. N is the size of the format string literal, which
+    // bounds the number of operations, literal characters and delta formats.
+
+  public:
+    wchar_t     text   [N] {};      // Literal characters
+    StaticOp    ops    [N] {};      // Output operations, in order
+    StaticDelta deltas [N] {};      // Delta time formats referenced by Delta ops
+
+    size_t textLength { 0 };
+    size_t opCount    { 0 };
+    size_t deltaCount { 0 };
+    size_t maxLength  { 0 };        // Maximum output length, not counting zone names
+
+    constexpr void addLiteral (wchar_t c) {
+        if (opCount == 0 || ops[opCount-1].type != StaticOpType::Literal)
+            ops[opCount++] = { StaticOpType::Literal, textLength, 0 };
+        text[textLength++] = c;
+        ++ops[opCount-1].length;
+        ++maxLength;
+    }
+
+    constexpr void addOp (StaticOpType type, size_t length = 0) {
+        ops[opCount++] = { type, 0, length };
+        maxLength += maxOpLength (type, length);
+    }
+
+    constexpr void addDelta (const StaticDelta& delta) {
+        ops[opCount++] = { StaticOpType::Delta, deltaCount, 0 };
+        deltas[deltaCount++] = delta;
+
+        // Whole seconds and sub-second digits, separators, zero padding, and the fraction.
+        maxLength += 28 + 10 + 20 + (delta.precision ? delta.precision + 1 : 0);
+    }
+
+    static constexpr size_t maxOpLength (StaticOpType type, size_t length) {
+        switch (type) {
+            case StaticOpType::Year:
+            case StaticOpType::Century:         return 11;
+            case StaticOpType::YearDay:         return 3;
+            case StaticOpType::WeekdayMonday:
+            case StaticOpType::WeekdaySunday:   return 1;
+            case StaticOpType::Date:            return 11 + 6;
+            case StaticOpType::Time:            return 8;
+            case StaticOpType::HourMinute:      return 5;
+            case StaticOpType::DateUS:          return 8;
+            case StaticOpType::DateTime:        return 11 + 6 + 9 + 5;
+            case StaticOpType::ZoneOffset:      return 5;
+            case StaticOpType::ZoneName:        return 0;
+            case StaticOpType::Fraction:        return length;
+            default:                            return 2;
+        }
+    }
+};
+
+//__________________________________________________________________________________________________
+
+constexpr bool staticIsDigit (wchar_t c) {
+    return L'0' <= c && c <= L'9';
+}
+
+constexpr bool staticCharIn (wchar_t c, const wchar_t* list) {
+    for (;  *list;  ++list) {
+        if (c == *list) return true;
+    }
+    return false;
+}
+
+constexpr int staticNumDigits (int64_t x) {
+    int digits = 1;
+    for (;  x >= 10;  x /= 10)
+        ++digits;
+    return digits;
+}
+
+//__________________________________________________________________________________________________
+
+constexpr size_t parseStaticDelta (const wchar_t* format, size_t i, size_t end, StaticDelta& delta) {
+    // Parses the delta time format that starts at index i, just after the `%_`, with the same
+    // syntax as the run-time format compiler. Returns the index just past the delta format.
+
+    const int64_t nanosecondsPerSecond = 1000000000;
+    const int64_t secondsPerDay        = 86400;
+    const int64_t secondsPerYear       = secondsPerDay * 365;
+    const int64_t secondsPerTropical   = secondsPerYear + (secondsPerDay / 400) * 497;     // As in the run-time formatter
+
+    if (i < end && format[i] == L'\'') {
+        if (i + 3 > end) throw "Incomplete delta time number format";
+        delta.thousandsChar = (format[i+1] == L'0') ? 0 : format[i+1];
+        delta.decimalChar   = format[i+2];
+        i += 3;
+    }
+
+    if (i >= end) throw "Incomplete delta time format";
+
+    auto moduloUnit = format[i];
+
+    switch (moduloUnit) {
+        case L'y':  delta.moduloSeconds = secondsPerYear;                               break;
+        case L't':  delta.moduloSeconds = secondsPerTropical;                           break;
+        case L'd':  delta.moduloSeconds = secondsPerDay;                                break;
+        case L'h':  delta.moduloSeconds = 3600;                                         break;
+        case L'm':  delta.moduloSeconds = 60;                                           break;
+        case L's':  delta.moduloSeconds = 1;                                            break;
+        default:    moduloUnit = 0;                                                     break;
+    }
+
+    if (moduloUnit) ++i;
+    if (i >= end) throw "Incomplete delta time format";
+
+    auto leadingZeros = moduloUnit && (format[i] == L'0');
+    if (leadingZeros && ++i >= end) throw "Incomplete delta time format";
+
+    auto unitType = format[i++];
+    const wchar_t* legalModulos = L"";
+
+    switch (unitType) {
+        case L'Y':  delta.unitValue = secondsPerYear * nanosecondsPerSecond;  break;
+        case L'T':  delta.unitValue = secondsPerTropical * nanosecondsPerSecond;  break;
+        case L'D':  delta.unitValue = secondsPerDay * nanosecondsPerSecond;  legalModulos = L"ty";     break;
+        case L'H':  delta.unitValue = 3600 * nanosecondsPerSecond;           legalModulos = L"tyd";    break;
+        case L'M':  delta.unitValue = 60 * nanosecondsPerSecond;             legalModulos = L"tydh";   break;
+        case L'S':  delta.unitValue = nanosecondsPerSecond;                  legalModulos = L"tydhm";  break;
+        case L'L':  delta.unitValue = 1000000;                               legalModulos = L"tydhms"; break;
+        case L'U':  delta.unitValue = 1000;                                  legalModulos = L"tydhms"; break;
+        case L'N':  delta.unitValue = 1;                                     legalModulos = L"tydhms"; break;
+        default:    throw "Unrecognized delta time unit";
+    }
+
+    if (moduloUnit && !staticCharIn (moduloUnit, legalModulos))
+        throw "Invalid modulo unit for delta time unit";
+
+    if (leadingZeros)
+        delta.leadingZeros = staticNumDigits (delta.moduloSeconds * nanosecondsPerSecond / delta.unitValue - 1);
+
+    auto hasPoint  = (i < end) && (format[i] == L'.');
+    auto hasDigits = hasPoint && (i + 1 < end) && staticIsDigit (format[i+1]);
+
+    if (unitType == L'N' || (unitType == L'S' && !hasDigits))
+        return i;   // No fractional value; a bare '.' after seconds is literal text.
+
+    if (hasPoint) {
+        ++i;
+        if (!hasDigits) {
+            switch (unitType) {
+                case L'T':
+                case L'Y': delta.precision = 8; break;
+                case L'D': delta.precision = 5; break;
+                case L'H': delta.precision = 4; break;
+                case L'M': delta.precision = 2; break;
+                case L'L': delta.precision = 6; break;
+                case L'U': delta.precision = 3; break;
+            }
+        } else {
+            while (i < end && staticIsDigit (format[i]))
+                delta.precision = 10 * delta.precision + (format[i++] - L'0');
+        }
+    }
+
+    return i;
+}
+
+//__________________________________________________________________________________________________
+
+template <size_t N>
+constexpr StaticFormat<N> staticFormat (const wchar_t (&format)[N], wchar_t codeChar = L'%') {
+    // Parses the format string literal into a static format, with the same escape sequences and
+    // format codes as timeprint::Format. Unrecognized or unsupported codes, which would otherwise
+    // be printed as-is, are compile errors when the result is a constant expression.
+
+    StaticFormat<N> result;
+
+    size_t end = N - 1;
+    size_t i   = 0;
+
+    while (i < end) {
+        auto c = format[i++];
+
+        if (c == L'\\' && codeChar != L'\\') {
+            if (i == end) {
+                result.addLiteral (L'\\');
+                continue;
+            }
+
+            switch (c = format[i++]) {
+                case L'n':  result.addLiteral (L'\n');  break;
+                case L't':  result.addLiteral (L'\t');  break;
+                case L'b':  result.addLiteral (L'\b');  break;
+                case L'r':  result.addLiteral (L'\r');  break;
+                case L'a':  result.addLiteral (L'\a');  break;
+                default:    result.addLiteral (c);      break;
+            }
+
+        } else if (c != codeChar) {
+            result.addLiteral (c);
+
+        } else if (i == end) {
+            throw "Format ends with a bare code character";
+
+        } else if (format[i] == L'_') {
+            StaticDelta delta;
+            i = parseStaticDelta (format, i + 1, end, delta);
+            result.addDelta (delta);
+
+        } else if (format[i] == L'-' || staticIsDigit (format[i])) {
+            int digits = 0;
+            while (i < end && staticIsDigit (format[i]))
+                digits = 10 * digits + (format[i++] - L'0');
+
+            if (i == end || format[i] != L'N' || digits < 1 || digits > 9)
+                throw "Numeric prefixes are supported only for %<d>N, from 1 through 9";
+
+            ++i;
+            result.addOp (StaticOpType::Fraction, static_cast<size_t>(digits));
+
+        } else if (format[i] == codeChar) {
+            result.addLiteral (codeChar);
+            ++i;
+
+        } else {
+            // The '#' flag is meaningful only for locale-dependent codes, except for %#z, %#Z and
+            // %#N, which are the same as their unflagged forms.
+
+            if (format[i] == L'#') {
+                if (i + 1 == end || !staticCharIn (format[i+1], L"zZN"))
+                    throw "The '#' flag is supported only for %#z, %#Z and %#N";
+                ++i;
+            }
+
+            switch (format[i++]) {
+                case L'n':  result.addLiteral (L'\n');  break;
+                case L't':  result.addLiteral (L'\t');  break;
+
+                case L'Y':  result.addOp (StaticOpType::Year);           break;
+                case L'C':  result.addOp (StaticOpType::Century);        break;
+                case L'y':  result.addOp (StaticOpType::YearOfCentury);  break;
+                case L'm':  result.addOp (StaticOpType::Month);          break;
+                case L'd':  result.addOp (StaticOpType::Day);            break;
+                case L'e':  result.addOp (StaticOpType::DaySpace);       break;
+                case L'H':  result.addOp (StaticOpType::Hour);           break;
+                case L'I':  result.addOp (StaticOpType::Hour12);         break;
+                case L'M':  result.addOp (StaticOpType::Minute);         break;
+                case L'S':  result.addOp (StaticOpType::Second);         break;
+                case L'j':  result.addOp (StaticOpType::YearDay);        break;
+                case L'u':  result.addOp (StaticOpType::WeekdayMonday);  break;
+                case L'w':  result.addOp (StaticOpType::WeekdaySunday);  break;
+                case L'F':  result.addOp (StaticOpType::Date);           break;
+                case L'T':  result.addOp (StaticOpType::Time);           break;
+                case L'R':  result.addOp (StaticOpType::HourMinute);     break;
+                case L'D':  result.addOp (StaticOpType::DateUS);         break;
+                case L'i':  result.addOp (StaticOpType::DateTime);       break;
+                case L'z':  result.addOp (StaticOpType::ZoneOffset);     break;
+                case L'Z':  result.addOp (StaticOpType::ZoneName);       break;
+                case L'N':  result.addOp (StaticOpType::Fraction, 9);    break;
+
+                default:
+                    throw "Unrecognized, locale-dependent or week-based format code";
+            }
+        }
+    }
+
+    return result;
+}
+
+//__________________________________________________________________________________________________
+
+inline wchar_t* putDigits (wchar_t* out, int64_t value, int width) {
+    // Writes the non-negative value with at least the given number of digits, zero padded.
+
+    wchar_t digits[20];
+    int     count = 0;
+
+    do {
+        digits[count++] = static_cast<wchar_t>(L'0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    for (int i = count;  i < width;  ++i)
+        *out++ = L'0';
+
+    while (count > 0)
+        *out++ = digits[--count];
+
+    return out;
+}
+
+inline wchar_t* putTwoDigits (wchar_t* out, int value) {
+    *out++ = static_cast<wchar_t>(L'0' + value / 10);
+    *out++ = static_cast<wchar_t>(L'0' + value % 10);
+    return out;
+}
+
+inline wchar_t* putYear (wchar_t* out, int year) {
+    if (year < 0) {
+        *out++ = L'-';
+        year = -year;
+    }
+    return putDigits (out, year, 1);
+}
+
+inline wchar_t* putCentury (wchar_t* out, int year) {
+    // Writes the century of the year as the run-time formatter does, rounded toward negative
+    // infinity, so that year -876 is in century -9.
+
+    auto century = (year >= 0) ? (year / 100) : -((99 - year) / 100);
+
+    if (century < 0) {
+        *out++ = L'-';
+        return putDigits (out, -century, 1);
+    }
+    return putDigits (out, century, 2);
+}
+
+inline int yearOfCentury (int year) {
+    // Returns the year within its century, from 0 to 99 for years before 0 too.
+    return ((year % 100) + 100) % 100;
+}
+
+//__________________________________________________________________________________________________
+
+inline wchar_t* putStaticDelta (wchar_t* out, const StaticDelta& delta, Time deltaTime) {
+    // Writes the time difference according to the delta time format, exactly as the run-time
+    // formatter does: the value is split into whole units and a fraction, rounded half up to the
+    // requested precision, and written with padding, separators and the decimal character.
+
+    const int64_t nanosecondsPerSecond = 1000000000;
+
+    auto seconds     = delta.moduloSeconds ? deltaTime.seconds % delta.moduloSeconds : deltaTime.seconds;
+    auto nanoseconds = deltaTime.nanoseconds;
+    auto unitValue   = delta.unitValue;
+
+    int64_t whole;
+    int64_t subUnits       = 0;
+    int64_t unitsPerSecond = 0;
+    int64_t fraction;
+
+    if (unitValue >= nanosecondsPerSecond) {
+        auto unitSeconds = unitValue / nanosecondsPerSecond;
+        whole    = seconds / unitSeconds;
+        fraction = (seconds % unitSeconds) * nanosecondsPerSecond + nanoseconds;
+    } else {
+        unitsPerSecond = nanosecondsPerSecond / unitValue;
+        whole    = seconds;
+        subUnits = nanoseconds / unitValue;
+        fraction = nanoseconds % unitValue;
+    }
+
+    auto precision = delta.precision;
+
+    if (precision) {
+        int64_t scale = 1;
+        for (int i = 0;  (i < precision) && (scale <= unitValue);  ++i)
+            scale *= 10;
+
+        if ((scale <= unitValue) && ((unitValue - fraction) <= unitValue / (2 * scale))) {
+            fraction = 0;
+            if (!unitsPerSecond) {
+                ++whole;
+            } else if (++subUnits == unitsPerSecond) {
+                subUnits = 0;
+                ++whole;
+            }
+        }
+    }
+
+    wchar_t  wholeDigits[40];
+    wchar_t* digitsEnd;
+
+    if (!unitsPerSecond) {
+        digitsEnd = putDigits (wholeDigits, whole, 1);
+    } else if (whole == 0) {
+        digitsEnd = putDigits (wholeDigits, subUnits, 1);
+    } else {
+        digitsEnd = putDigits (wholeDigits, whole, 1);
+        for (auto place = unitsPerSecond / 10;  place > 0;  place /= 10)
+            *digitsEnd++ = static_cast<wchar_t>(L'0' + subUnits / place % 10);
+    }
+
+    auto numDigits   = static_cast<int>(digitsEnd - wholeDigits);
+    auto fieldLength = numDigits + (precision ? precision + 1 : 0);
+    auto numZeros    = (delta.leadingZeros > fieldLength) ? delta.leadingZeros - fieldLength : 0;
+    auto wholeLength = numZeros + numDigits;
+
+    for (int i = 0;  i < wholeLength;  ++i) {
+        if (delta.thousandsChar && i > 0 && (wholeLength - i) % 3 == 0)
+            *out++ = delta.thousandsChar;
+        *out++ = (i < numZeros) ? L'0' : wholeDigits[i - numZeros];
+    }
+
+    if (precision == 0)
+        return out;
+
+    *out++ = delta.decimalChar;
+
+    for (int i = 0;  i < precision;  ++i) {
+        fraction *= 10;
+        *out++ = static_cast<wchar_t>(L'0' + fraction / unitValue);
+        fraction %= unitValue;
+    }
+
+    if (2 * fraction >= unitValue) {
+        auto digit = out - 1;
+        while (*digit == L'9')
+            *digit-- = L'0';
+        ++*digit;
+    }
+
+    return out;
+}
+
+//__________________________________________________________________________________________________
+
+template <const auto& format, size_t I>
+inline void renderStaticOp (wchar_t*& out, const TimeFields& fields, Time deltaTime) {
+    // Writes the output of a single operation of the static format. The operation is selected at
+    // compile time.
+
+    constexpr StaticOp op = format.ops[I];
+
+    if constexpr (op.type == StaticOpType::Literal) {
+        if constexpr (op.length == 1) {
+            *out++ = format.text[op.index];
+        } else {
+            std::wmemcpy (out, format.text + op.index, op.length);
+            out += op.length;
+        }
+    } else if constexpr (op.type == StaticOpType::Year) {
+        out = putYear (out, fields.year);
+    } else if constexpr (op.type == StaticOpType::Century) {
+        out = putCentury (out, fields.year);
+    } else if constexpr (op.type == StaticOpType::YearOfCentury) {
+        out = putTwoDigits (out, yearOfCentury (fields.year));
+    } else if constexpr (op.type == StaticOpType::Month) {
+        out = putTwoDigits (out, fields.month);
+    } else if constexpr (op.type == StaticOpType::Day) {
+        out = putTwoDigits (out, fields.day);
+    } else if constexpr (op.type == StaticOpType::DaySpace) {
+        *out++ = (fields.day < 10) ? L' ' : static_cast<wchar_t>(L'0' + fields.day / 10);
+        *out++ = static_cast<wchar_t>(L'0' + fields.day % 10);
+    } else if constexpr (op.type == StaticOpType::Hour) {
+        out = putTwoDigits (out, fields.hour);
+    } else if constexpr (op.type == StaticOpType::Hour12) {
+        out = putTwoDigits (out, (fields.hour + 11) % 12 + 1);
+    } else if constexpr (op.type == StaticOpType::Minute) {
+        out = putTwoDigits (out, fields.minute);
+    } else if constexpr (op.type == StaticOpType::Second) {
+        out = putTwoDigits (out, fields.second);
+    } else if constexpr (op.type == StaticOpType::YearDay) {
+        out = putDigits (out, fields.yearDay + 1, 3);
+    } else if constexpr (op.type == StaticOpType::WeekdayMonday) {
+        *out++ = static_cast<wchar_t>(L'0' + (fields.weekday ? fields.weekday : 7));
+    } else if constexpr (op.type == StaticOpType::WeekdaySunday) {
+        *out++ = static_cast<wchar_t>(L'0' + fields.weekday);
+    } else if constexpr (op.type == StaticOpType::Date || op.type == StaticOpType::DateTime) {
+        out = putYear (out, fields.year);
+        *out++ = L'-';
+        out = putTwoDigits (out, fields.month);
+        *out++ = L'-';
+        out = putTwoDigits (out, fields.day);
+    } else if constexpr (op.type == StaticOpType::DateUS) {
+        out = putTwoDigits (out, fields.month);
+        *out++ = L'/';
+        out = putTwoDigits (out, fields.day);
+        *out++ = L'/';
+        out = putTwoDigits (out, yearOfCentury (fields.year));
+    }
+
+    if constexpr (op.type == StaticOpType::DateTime)
+        *out++ = L'T';
+
+    if constexpr (op.type == StaticOpType::Time || op.type == StaticOpType::HourMinute
+               || op.type == StaticOpType::DateTime) {
+        out = putTwoDigits (out, fields.hour);
+        *out++ = L':';
+        out = putTwoDigits (out, fields.minute);
+        if constexpr (op.type != StaticOpType::HourMinute) {
+            *out++ = L':';
+            out = putTwoDigits (out, fields.second);
+        }
+    }
+
+    if constexpr (op.type == StaticOpType::ZoneOffset || op.type == StaticOpType::DateTime) {
+        auto minutes = ((fields.utcOffset < 0) ? -fields.utcOffset : fields.utcOffset) / 60;
+        *out++ = (fields.utcOffset < 0) ? L'-' : L'+';
+        out = putTwoDigits (out, minutes / 60);
+        out = putTwoDigits (out, minutes % 60);
+    } else if constexpr (op.type == StaticOpType::ZoneName) {
+        auto length = std::wcslen (fields.zoneName);
+        std::wmemcpy (out, fields.zoneName, length);
+        out += length;
+    } else if constexpr (op.type == StaticOpType::Fraction) {
+        int32_t divisor = 100000000;
+        for (size_t i = 0;  i < op.length;  ++i, divisor /= 10)
+            *out++ = static_cast<wchar_t>(L'0' + fields.nanosecond / divisor % 10);
+    } else if constexpr (op.type == StaticOpType::Delta) {
+        out = putStaticDelta (out, format.deltas[op.index], deltaTime);
+    }
+}
+
+//__________________________________________________________________________________________________
+
+template <const auto& format, size_t... I>
+inline void renderStatic (
+    std::wstring& output, const TimeFields& fields, Time deltaTime, std::index_sequence<I...>)
+{
+    // Renders every operation of the static format in place at the end of the output. The output is
+    // sized once for the longest possible result, then trimmed to the actual length.
+
+    auto start = output.length();
+    auto zoneNameLength = size_t(0);
+
+    for (size_t i = 0;  i < format.opCount;  ++i) {
+        if (format.ops[i].type == StaticOpType::ZoneName)
+            zoneNameLength += std::wcslen (fields.zoneName);
+    }
+
+    output.resize (start + format.maxLength + zoneNameLength);
+
+    auto out = &output[start];
+    (renderStaticOp<format, I> (out, fields, deltaTime), ...);
+
+    output.resize (static_cast<size_t>(out - output.data()));
+}
+
+//__________________________________________________________________________________________________
+
+template <const auto& format>
+inline void formatTime (std::wstring& output, const Context& context, Time time) {
+    // Appends the time, formatted with the static format in the context's time zone, to the output.
+
+    renderStatic<format> (output, context.fields (time), Time(), std::make_index_sequence<format.opCount>());
+}
+
+template <const auto& format>
+inline void formatDelta (std::wstring& output, Time time1, Time time2) {
+    // Appends the difference between the two times, formatted with the static format, to the
+    // output. As with Context::formatDelta(), date and time codes report the difference as a UTC
+    // time since 1970-01-01.
+
+    auto seconds     = time2.seconds - time1.seconds;
+    auto nanoseconds = time2.nanoseconds - time1.nanoseconds;
+
+    if ((seconds < 0) || ((seconds == 0) && (nanoseconds < 0))) {
+        seconds     = -seconds;
+        nanoseconds = -nanoseconds;
+    }
+
+    if (nanoseconds < 0) {
+        nanoseconds += 1000000000;
+        --seconds;
+    }
+
+    Time deltaTime (seconds, nanoseconds);
+    renderStatic<format> (output, utcFields (deltaTime), deltaTime, std::make_index_sequence<format.opCount>());
+}
+
+}